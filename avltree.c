@@ -115,35 +115,45 @@ static AVLNode _AVL_del_min( AVLNode node )
     }
 
     node->left = _AVL_del_min( node->left );
-    return _AVL_balance( node );
+    return _AVN_balance( node );
 }
 
-static AVLNode _AVL_delete( AVLTree tree, AVLNode *node, TREE_KEY_TYPE key )
+/*
+ *  Delete existing key and rebalance nodes on its path, bottom-up (so
+ *  heights stay exact):
+ */
+static AVLNode _AVL_delete( AVLTree tree, AVLNode node, TREE_KEY_TYPE key )
 {
-    if( *node ) {
-        AVLNode y = ( *node )->left;
-        AVLNode z = ( *node )->right;
-        AVLNode m;
+    AVLNode y, z, m;
 
-        if( tree->destructor && ( *node )->data ) {
-            tree->destructor( ( *node )->data );
-        }
+    if( key < node->key ) {
+        node->left = _AVL_delete( tree, node->left, key );
+        return _AVN_balance( node );
+    }
 
-        Free( *node );
-        *node = NULL;
-        tree->nodes--;
+    if( key > node->key ) {
+        node->right = _AVL_delete( tree, node->right, key );
+        return _AVN_balance( node );
+    }
 
-        if( !z ) {
-            return y;
-        }
+    y = node->left;
+    z = node->right;
 
-        m = _AVL_min( z );
-        m->right = _AVL_del_min( z );
-        m->left = y;
-        return _AVL_balance( m );
+    if( tree->destructor && node->data ) {
+        tree->destructor( node->data );
     }
 
-    return NULL;
+    Free( node );
+    tree->nodes--;
+
+    if( !z ) {
+        return y;
+    }
+
+    m = _AVL_min( z );
+    m->right = _AVL_del_min( z );
+    m->left = y;
+    return _AVN_balance( m );
 }
 
 static void _AVL_clear( AVLTree tree, AVLNode *node )
@@ -221,7 +231,7 @@ int AVL_delete( const AVLTree tree, TREE_KEY_TYPE key )
         node = _AVL_search( &tree->head, key );
 
         if( node ) {
-            *node = _AVL_delete( tree, node, key );
+            tree->head = _AVL_delete( tree, tree->head, key );
             rc = 1;
         }
         else {
@@ -382,24 +392,14 @@ static void _AVL_dump( AVLNode node, Tree_KeyDump kdumper,
     }
 }
 
-static size_t _AVL_depth( AVLNode node, size_t depth )
-{
-    size_t left, right;
-
-    if( !node ) {
-        return depth;
-    }
-
-    left = _AVL_depth( node->left, depth + 1 );
-    right = _AVL_depth( node->right, depth + 1 );
-    return left > right ? left : right;
-}
-
+/*
+ *  Heights are kept by balancing, so depth is height of the root:
+ */
 size_t AVL_depth( const AVLTree tree )
 {
     size_t rc;
     __lock( tree->lock );
-    rc = _AVL_depth( tree->head, 0 );
+    rc = _AVN_height( tree->head );
     __unlock( tree->lock );
     return rc;
 }
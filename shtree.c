@@ -0,0 +1,306 @@
+/*
+ * shtree.c, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 16:24
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "shtree.h"
+
+void _TT_cursor_init( TT_Cursor *cursor, TTNodeConst node, size_t off,
+                      const char *prefix, size_t len, Tree_Flags flags );
+
+/*
+ *  Internal, weight of leading byte when ranges are split. Letters and
+ *  digits start most of keys, uppercase letters never start keys of
+ *  T_NOCASE tree (they are folded).
+ */
+static size_t _SH_weight( unsigned c, Tree_Flags flags )
+{
+    if( c >= 'A' && c <= 'Z' ) {
+        return ( flags & T_NOCASE ) ? 0 : 8;
+    }
+
+    if( ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' ) ) {
+        return 8;
+    }
+
+    return 1;
+}
+
+/*
+ *  Internal, map leading bytes to shards. Map is monotonic, so shards hold
+ *  ascending byte ranges.
+ */
+static void _SH_route( SHTree tree )
+{
+    size_t c, sum = 0, total = 0;
+
+    for( c = 0; c < 256; c++ ) {
+        total += _SH_weight( c, tree->flags );
+    }
+
+    for( c = 0; c < 256; c++ ) {
+        tree->route[c] = ( unsigned char )( sum * tree->count / total );
+        sum += _SH_weight( c, tree->flags );
+    }
+}
+
+SHTree SH_create( Tree_Flags flags, Tree_Destroy destructor, size_t count )
+{
+    SHTree tree;
+    size_t i;
+
+    if( !count ) {
+        count = SH_SHARDS;
+    }
+
+    if( count > 256 ) {
+        return NULL;
+    }
+
+    tree = Calloc( sizeof( struct _SHTree ), 1 );
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    tree->shards = Calloc( sizeof( TTree ), count );
+
+    if( !tree->shards ) {
+        Free( tree );
+        return NULL;
+    }
+
+    tree->flags = flags;
+    tree->count = count;
+    _SH_route( tree );
+
+    for( i = 0; i < count; i++ ) {
+        tree->shards[i] = TT_create( flags, destructor );
+
+        if( !tree->shards[i] ) {
+            SH_destroy( tree );
+            return NULL;
+        }
+    }
+
+    return tree;
+}
+
+void SH_clear( SHTree tree )
+{
+    if( tree ) {
+        size_t i;
+
+        for( i = 0; i < tree->count; i++ ) {
+            TT_clear( tree->shards[i] );
+        }
+    }
+}
+
+void SH_destroy( SHTree tree )
+{
+    if( tree ) {
+        size_t i;
+
+        for( i = 0; i < tree->count; i++ ) {
+            if( tree->shards[i] ) {
+                TT_destroy( tree->shards[i] );
+            }
+        }
+
+        Free( tree->shards );
+        Free( tree );
+    }
+}
+
+TTree SH_shard( const SHTree tree, const char *key )
+{
+    char lead[2];
+
+    if( !tree || !key || !*key ) {
+        return NULL;
+    }
+
+    /*
+     * Two-byte UTF-8 letter may change its leading byte when folded:
+     */
+    if( tree->flags & T_NOCASE ) {
+        T_Fold( lead, key, key[1] ? 2 : 1 );
+    }
+    else {
+        lead[0] = *key;
+    }
+
+    return tree->shards[tree->route[( unsigned char ) lead[0]]];
+}
+
+TTNodeConst SH_insert( const SHTree tree, const char *key, void *data )
+{
+    TTree shard = SH_shard( tree, key );
+    return shard ? TT_insert( shard, key, data ) : NULL;
+}
+
+TTNodeConst SH_search( const SHTree tree, const char *key )
+{
+    TTree shard = SH_shard( tree, key );
+    return shard ? TT_search( shard, key ) : NULL;
+}
+
+int SH_del_key( const SHTree tree, const char *key )
+{
+    TTree shard = SH_shard( tree, key );
+    return shard ? TT_del_key( shard, key ) : 0;
+}
+
+int SH_del_node( const SHTree tree, const char *key )
+{
+    TTree shard = SH_shard( tree, key );
+    return shard ? TT_del_node( shard, key ) : 0;
+}
+
+/*
+ *  Internal, collect up to 'max' keys of all shards to one TT_Data array.
+ *  Shards are locked in ascending order and released together.
+ */
+static TT_Data _SH_collect( SHTree tree, size_t max, size_t *count )
+{
+    TT_Cursor cursor;
+    TT_Data data = NULL;
+    size_t i, idx = 0, size = 0;
+    int ok = 1;
+
+    for( i = 0; i < tree->count; i++ ) {
+        __lock( tree->shards[i]->lock );
+    }
+
+    for( i = 0; ok && i < tree->count && idx < max; i++ ) {
+        _TT_cursor_init( &cursor, tree->shards[i]->head, 0, NULL, 0,
+                         tree->flags );
+
+        while( idx < max && TT_prefix_next( &cursor ) ) {
+            idx++;
+            size += cursor.len + 1;
+        }
+
+        ok = cursor.error == TE_NO_ERROR;
+        TT_prefix_close( &cursor );
+    }
+
+    if( ok ) {
+        data = Calloc( sizeof( struct _TT_Data ) * ( idx + 1 ) + size, 1 );
+    }
+
+    if( data && idx ) {
+        char *ptr = ( char * )( data + idx + 1 );
+        TTNodeConst node;
+        max = idx;
+        idx = 0;
+
+        for( i = 0; i < tree->count && idx < max; i++ ) {
+            _TT_cursor_init( &cursor, tree->shards[i]->head, 0, NULL, 0,
+                             tree->flags );
+
+            while( idx < max && ( node = TT_prefix_next( &cursor ) ) != NULL ) {
+                memcpy( ptr, cursor.key, cursor.len + 1 );
+                data[idx].key = ptr;
+                data[idx].data = node->data;
+                data[idx].len = cursor.len;
+                ptr += cursor.len + 1;
+                idx++;
+            }
+
+            TT_prefix_close( &cursor );
+        }
+    }
+
+    for( i = tree->count; i--; ) {
+        __unlock( tree->shards[i]->lock );
+    }
+
+    if( data && count ) {
+        *count = idx;
+    }
+
+    return data;
+}
+
+TT_DataConst SH_nlookup( const SHTree tree, const char *prefix, size_t max,
+                         size_t *count )
+{
+    if( count ) {
+        *count = 0;
+    }
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    /*
+     * Prefix keys are all in one shard:
+     */
+    if( prefix && *prefix ) {
+        return TT_nlookup( SH_shard( tree, prefix ), prefix, max, count );
+    }
+
+    return _SH_collect( tree, max ? max : ( ( size_t ) - 1 ), count );
+}
+
+TT_DataConst SH_lookup( const SHTree tree, const char *prefix,
+                        size_t *count )
+{
+    return SH_nlookup( tree, prefix, 0, count );
+}
+
+TT_DataConst SH_data( const SHTree tree, size_t *count )
+{
+    return SH_nlookup( tree, NULL, 0, count );
+}
+
+int SH_walk_keys( const SHTree tree, TT_KeyWalk walker, void *data )
+{
+    size_t i;
+
+    if( !tree ) {
+        return 1;
+    }
+
+    for( i = 0; i < tree->count; i++ ) {
+        if( !TT_walk_keys( tree->shards[i], walker, data ) ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+size_t SH_keys( const SHTree tree )
+{
+    size_t i, keys = 0;
+
+    if( tree ) {
+        for( i = 0; i < tree->count; i++ ) {
+            __lock( tree->shards[i]->lock );
+            keys += tree->shards[i]->keys;
+            __unlock( tree->shards[i]->lock );
+        }
+    }
+
+    return keys;
+}
+
+size_t SH_nodes( const SHTree tree )
+{
+    size_t i, nodes = 0;
+
+    if( tree ) {
+        for( i = 0; i < tree->count; i++ ) {
+            __lock( tree->shards[i]->lock );
+            nodes += tree->shards[i]->nodes;
+            __unlock( tree->shards[i]->lock );
+        }
+    }
+
+    return nodes;
+}
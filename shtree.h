@@ -0,0 +1,87 @@
+/*
+ * shtree.h, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 16:20
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+/*
+ * Sharded ternary tree: keys are partitioned by (folded) leading byte into
+ * ascending byte ranges, each range is independent TTree with its own lock.
+ * Writers of different shards do not wait for each other, and walking
+ * shards one by one gives global key order.
+ */
+
+#ifndef SHTREE_H_
+#define SHTREE_H_
+
+#include "ttree.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#ifndef SH_SHARDS
+# define SH_SHARDS 16
+#endif
+
+typedef struct _SHTree {
+    Tree_Flags flags;
+    size_t count;
+    TTree *shards;
+    unsigned char route[256];
+} *SHTree;
+
+/*
+ *  Create tree with 'count' shards (1..256, 0 means SH_SHARDS). Ranges are
+ *  wider for rare leading bytes and narrower for letters and digits. Flags
+ *  and destructor are passed to every shard.
+ */
+SHTree SH_create( Tree_Flags flags, Tree_Destroy destructor, size_t count );
+void SH_clear( SHTree tree );
+void SH_destroy( SHTree tree );
+
+/*
+ *  Get shard holding key (or keys started by prefix) to call any TT_*
+ *  function on it directly. Return NULL for NULL or empty key.
+ */
+TTree SH_shard( const SHTree tree, const char *key );
+
+/*
+ *  Same semantics as TT_insert(), TT_search(), TT_del_key() and
+ *  TT_del_node(), only shard of key is locked.
+ */
+TTNodeConst SH_insert( const SHTree tree, const char *key, void *data );
+TTNodeConst SH_search( const SHTree tree, const char *key );
+int SH_del_key( const SHTree tree, const char *key );
+int SH_del_node( const SHTree tree, const char *key );
+
+/*
+ *  Same semantics as TT_lookup() and TT_nlookup(), but NULL or empty prefix
+ *  means all keys. Then all shards are locked (in order) and result is
+ *  consistent snapshot, as TT_data() is.
+ */
+TT_DataConst SH_lookup( const SHTree tree, const char *prefix,
+                        size_t *count );
+TT_DataConst SH_nlookup( const SHTree tree, const char *prefix, size_t max,
+                         size_t *count );
+TT_DataConst SH_data( const SHTree tree, size_t *count );
+
+/*
+ *  Walk keys in ascending order, shard by shard (each shard is locked while
+ *  it is walked). Return 0 if walker stopped walking, or 1.
+ */
+int SH_walk_keys( const SHTree tree, TT_KeyWalk walker, void *data );
+
+/*
+ *  Get keys and nodes number of all shards.
+ */
+size_t SH_keys( const SHTree tree );
+size_t SH_nodes( const SHTree tree );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHTREE_H_ */
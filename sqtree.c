@@ -0,0 +1,576 @@
+/*
+ * sqtree.c, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 12:44
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "sqtree.h"
+#include <errno.h>
+
+static size_t _SQ_size( SQNode node )
+{
+    return node ? node->size : 0;
+}
+
+static void _SQ_update( SQNode node )
+{
+    node->size = _SQ_size( node->left ) + _SQ_size( node->right ) + 1;
+}
+
+/*
+ * Internal, apply pending reverse to node children:
+ */
+static void _SQ_push( SQNode node )
+{
+    if( node->reverse ) {
+        SQNode tmp = node->left;
+        node->left = node->right;
+        node->right = tmp;
+
+        if( node->left ) {
+            node->left->reverse ^= 1;
+        }
+
+        if( node->right ) {
+            node->right->reverse ^= 1;
+        }
+
+        node->reverse = 0;
+    }
+}
+
+static void _SQ_rotate( SQNode x )
+{
+    SQNode p = x->parent;
+    SQNode g = p->parent;
+
+    if( p->left == x ) {
+        p->left = x->right;
+
+        if( x->right ) {
+            x->right->parent = p;
+        }
+
+        x->right = p;
+    }
+    else {
+        p->right = x->left;
+
+        if( x->left ) {
+            x->left->parent = p;
+        }
+
+        x->left = p;
+    }
+
+    p->parent = x;
+    x->parent = g;
+
+    if( g ) {
+        if( g->left == p ) {
+            g->left = x;
+        }
+        else {
+            g->right = x;
+        }
+    }
+
+    _SQ_update( p );
+    _SQ_update( x );
+}
+
+/*
+ * Internal, move node to root. All nodes on path must be pushed already.
+ */
+static SQNode _SQ_splay( SQNode x )
+{
+    while( x->parent ) {
+        SQNode p = x->parent;
+        SQNode g = p->parent;
+
+        if( g ) {
+            if( ( g->left == p ) == ( p->left == x ) ) {
+                _SQ_rotate( p );
+            }
+            else {
+                _SQ_rotate( x );
+            }
+        }
+
+        _SQ_rotate( x );
+    }
+
+    return x;
+}
+
+/*
+ * Internal, splay node at position idx (idx < size) to root:
+ */
+static SQNode _SQ_find( SQNode node, size_t idx )
+{
+    for( ;; ) {
+        size_t left;
+        _SQ_push( node );
+        left = _SQ_size( node->left );
+
+        if( idx < left ) {
+            node = node->left;
+        }
+        else if( idx > left ) {
+            idx -= left + 1;
+            node = node->right;
+        }
+        else {
+            return _SQ_splay( node );
+        }
+    }
+}
+
+/*
+ * Internal, split sequence: first 'idx' elements go to *left, rest to *right.
+ */
+static void _SQ_split( SQNode node, size_t idx, SQNode *left, SQNode *right )
+{
+    if( !idx ) {
+        *left = NULL;
+        *right = node;
+    }
+    else if( idx >= _SQ_size( node ) ) {
+        *left = node;
+        *right = NULL;
+    }
+    else {
+        node = _SQ_find( node, idx );
+        *left = node->left;
+        ( *left )->parent = NULL;
+        node->left = NULL;
+        _SQ_update( node );
+        *right = node;
+    }
+}
+
+static SQNode _SQ_merge( SQNode left, SQNode right )
+{
+    if( !left ) {
+        return right;
+    }
+
+    if( right ) {
+        left = _SQ_find( left, left->size - 1 );
+        left->right = right;
+        right->parent = left;
+        _SQ_update( left );
+    }
+
+    return left;
+}
+
+SQTree SQ_create( Tree_Flags flags, Tree_Destroy destructor )
+{
+    SQTree tree = Calloc( sizeof( struct _SQTree ), 1 );
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    if( destructor ) {
+        tree->destructor = destructor;
+    }
+    else if( flags & T_FREE_DEFAULT ) {
+        tree->destructor = T_Free;
+    }
+
+    tree->flags = flags;
+    __initlock( tree->lock );
+    return tree;
+}
+
+/*
+ * Internal, splay trees may be very deep, so destroy them without recursion:
+ */
+static void _SQ_clear( SQTree tree )
+{
+    SQNode node = tree->head;
+
+    while( node ) {
+        SQNode next;
+
+        if( node->left ) {
+            next = node->left;
+            node->left = next->right;
+            next->right = node;
+        }
+        else {
+            next = node->right;
+
+            if( tree->destructor && node->data ) {
+                tree->destructor( node->data );
+            }
+
+            Free( node );
+        }
+
+        node = next;
+    }
+
+    tree->head = NULL;
+}
+
+void SQ_clear( SQTree tree )
+{
+    if( tree ) {
+        __lock( tree->lock );
+        _SQ_clear( tree );
+        tree->error = 0;
+        __unlock( tree->lock );
+    }
+}
+
+void SQ_destroy( SQTree tree )
+{
+    __lock( tree->lock );
+    _SQ_clear( tree );
+    __unlock( tree->lock );
+    Free( tree );
+}
+
+size_t SQ_length( const SQTree tree )
+{
+    return tree ? _SQ_size( tree->head ) : 0;
+}
+
+SQNodeConst SQ_insert_at( const SQTree tree, size_t idx, void *data )
+{
+    SQNode node, left, right;
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    __lock( tree->lock );
+    tree->error = 0;
+
+    if( idx > _SQ_size( tree->head ) ) {
+        tree->error = ERANGE;
+        __unlock( tree->lock );
+        return NULL;
+    }
+
+    node = Calloc( sizeof( struct _SQNode ), 1 );
+
+    if( !node ) {
+        tree->error = ENOMEM;
+        __unlock( tree->lock );
+        return NULL;
+    }
+
+    node->data = data;
+    node->size = 1;
+    _SQ_split( tree->head, idx, &left, &right );
+
+    if( left ) {
+        left->parent = node;
+        node->left = left;
+    }
+
+    if( right ) {
+        right->parent = node;
+        node->right = right;
+    }
+
+    _SQ_update( node );
+    tree->head = node;
+    __unlock( tree->lock );
+    return node;
+}
+
+int SQ_erase_at( const SQTree tree, size_t idx )
+{
+    SQNode node;
+
+    if( !tree ) {
+        return 0;
+    }
+
+    __lock( tree->lock );
+    tree->error = 0;
+
+    if( idx >= _SQ_size( tree->head ) ) {
+        tree->error = ERANGE;
+        __unlock( tree->lock );
+        return 0;
+    }
+
+    node = _SQ_find( tree->head, idx );
+
+    if( node->left ) {
+        node->left->parent = NULL;
+    }
+
+    if( node->right ) {
+        node->right->parent = NULL;
+    }
+
+    tree->head = _SQ_merge( node->left, node->right );
+
+    if( tree->destructor && node->data ) {
+        tree->destructor( node->data );
+    }
+
+    Free( node );
+    __unlock( tree->lock );
+    return 1;
+}
+
+void *SQ_get( const SQTree tree, size_t idx )
+{
+    void *data = NULL;
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    __lock( tree->lock );
+    tree->error = 0;
+
+    if( idx < _SQ_size( tree->head ) ) {
+        tree->head = _SQ_find( tree->head, idx );
+        data = tree->head->data;
+    }
+    else {
+        tree->error = ERANGE;
+    }
+
+    __unlock( tree->lock );
+    return data;
+}
+
+SQTree SQ_split( const SQTree tree, size_t idx )
+{
+    SQTree rc;
+    SQNode left, right;
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    rc = SQ_create( tree->flags, tree->destructor );
+    __lock( tree->lock );
+    tree->error = 0;
+
+    if( !rc ) {
+        tree->error = ENOMEM;
+    }
+    else if( idx > _SQ_size( tree->head ) ) {
+        tree->error = ERANGE;
+        SQ_destroy( rc );
+        rc = NULL;
+    }
+    else {
+        _SQ_split( tree->head, idx, &left, &right );
+        tree->head = left;
+        rc->head = right;
+    }
+
+    __unlock( tree->lock );
+    return rc;
+}
+
+void SQ_concat( const SQTree tree, const SQTree tail )
+{
+    if( tree && tail && tree != tail ) {
+        /*
+         * Lock in address order, so concurrent SQ_concat( a, b ) and
+         * SQ_concat( b, a ) do not deadlock:
+         */
+        if( tree < tail ) {
+            __lock( tree->lock );
+            __lock( tail->lock );
+        }
+        else {
+            __lock( tail->lock );
+            __lock( tree->lock );
+        }
+
+        tree->head = _SQ_merge( tree->head, tail->head );
+        tail->head = NULL;
+        tree->error = 0;
+        __unlock( tail->lock );
+        __unlock( tree->lock );
+    }
+}
+
+int SQ_reverse_range( const SQTree tree, size_t from, size_t to )
+{
+    SQNode left, mid, right;
+
+    if( !tree ) {
+        return 0;
+    }
+
+    __lock( tree->lock );
+    tree->error = 0;
+
+    if( from > to || to > _SQ_size( tree->head ) ) {
+        tree->error = ERANGE;
+        __unlock( tree->lock );
+        return 0;
+    }
+
+    if( to - from > 1 ) {
+        _SQ_split( tree->head, to, &mid, &right );
+        _SQ_split( mid, from, &left, &mid );
+        mid->reverse ^= 1;
+        tree->head = _SQ_merge( _SQ_merge( left, mid ), right );
+    }
+
+    __unlock( tree->lock );
+    return 1;
+}
+
+/*
+ * Internal, in-order walk without recursion:
+ */
+static void _SQ_walk( SQNode node, SQ_Walk walker, void *data )
+{
+    while( node ) {
+        _SQ_push( node );
+
+        if( !node->left ) {
+            break;
+        }
+
+        node = node->left;
+    }
+
+    while( node ) {
+        walker( node, data );
+
+        if( node->right ) {
+            node = node->right;
+            _SQ_push( node );
+
+            while( node->left ) {
+                node = node->left;
+                _SQ_push( node );
+            }
+        }
+        else {
+            while( node->parent && node->parent->right == node ) {
+                node = node->parent;
+            }
+
+            node = node->parent;
+        }
+    }
+}
+
+void SQ_walk( const SQTree tree, SQ_Walk walker, void *data )
+{
+    if( tree && tree->head ) {
+        __lock( tree->lock );
+        _SQ_walk( tree->head, walker, data );
+        __unlock( tree->lock );
+    }
+}
+
+/*
+ * Internal, walk without recursion (by parent links), as _SQ_clear() and
+ * _SQ_walk() do. Next node is left or right child when node is entered
+ * from parent, right child when it is left from left child, or parent.
+ */
+static SQNode _SQ_next( SQNode node, SQNode prev )
+{
+    if( prev == node->parent ) {
+        if( node->left ) {
+            return node->left;
+        }
+
+        if( node->right ) {
+            return node->right;
+        }
+    }
+    else if( prev == node->left && node->right ) {
+        return node->right;
+    }
+
+    return node->parent;
+}
+
+static size_t _SQ_depth( SQNode node )
+{
+    SQNode stop = node->parent, prev = stop, next;
+    size_t depth = 0, max = 0;
+
+    while( node != stop ) {
+        if( prev == node->parent && ++depth > max ) {
+            max = depth;
+        }
+
+        next = _SQ_next( node, prev );
+
+        if( next == node->parent ) {
+            depth--;
+        }
+
+        prev = node;
+        node = next;
+    }
+
+    return max;
+}
+
+static void _SQ_dump( SQNode node, Tree_DataDump ddumper, char *indent,
+                      FILE *handle )
+{
+    SQNode stop = node->parent, prev = stop, next;
+
+    while( node != stop ) {
+        if( prev == node->parent ) {
+            T_Indent( indent, node->parent == stop ||
+                      node->parent->right == node || !node->parent->right,
+                      handle );
+            _SQ_push( node );
+            fprintf( handle, "[%zu]", node->size );
+
+            if( ddumper ) {
+                ddumper( node->data, handle );
+            }
+
+            fprintf( handle, "\n" );
+        }
+
+        next = _SQ_next( node, prev );
+
+        if( next == node->parent ) {
+            indent[strlen( indent ) - 2] = 0;
+        }
+
+        prev = node;
+        node = next;
+    }
+}
+
+int SQ_dump( const SQTree tree, Tree_DataDump ddumper, FILE *handle )
+{
+    if( tree && tree->head ) {
+        char *buf;
+        size_t depth;
+        __lock( tree->lock );
+        depth = _SQ_depth( tree->head );
+        buf = Calloc( depth + 1, 2 );
+
+        if( buf ) {
+            fprintf( handle, "length: %zu, depth: %zu\n", tree->head->size,
+                     depth );
+            _SQ_dump( tree->head, ddumper, buf, handle );
+            Free( buf );
+        }
+
+        __unlock( tree->lock );
+        return buf ? 1 : 0;
+    }
+
+    return 0;
+}
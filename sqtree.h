@@ -0,0 +1,78 @@
+/*
+ * sqtree.h, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 12:40
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+/*
+ * Splay tree based sequence (rope). Node position is implicit and comes
+ * from subtree sizes, so every operation below is amortized O(log n).
+ */
+
+#ifndef SQTREE_H_
+#define SQTREE_H_
+
+#include "tree.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct _SQNode {
+    void *data;
+    size_t size;
+    int reverse;
+    struct _SQNode *parent;
+    struct _SQNode *left;
+    struct _SQNode *right;
+} *SQNode;
+
+typedef struct _SQNode const *SQNodeConst;
+
+typedef void ( *SQ_Walk )( SQNodeConst node, void *data );
+
+typedef struct _SQTree {
+    Tree_Flags flags;
+    Tree_Destroy destructor;
+    int error;
+    SQNode head;
+    __lock_t( lock );
+} *SQTree;
+
+SQTree SQ_create( Tree_Flags flags, Tree_Destroy destructor );
+void SQ_clear( SQTree tree );
+void SQ_destroy( SQTree tree );
+
+size_t SQ_length( const SQTree tree );
+
+/*
+ * Sets tree->error to 0, ENOMEM or ERANGE. Index for SQ_insert_at() may be
+ * equal to sequence length (append).
+ */
+SQNodeConst SQ_insert_at( const SQTree tree, size_t idx, void *data );
+int SQ_erase_at( const SQTree tree, size_t idx );
+void *SQ_get( const SQTree tree, size_t idx );
+
+/*
+ * Move elements [idx, length) to new sequence. Return NULL on error.
+ */
+SQTree SQ_split( const SQTree tree, size_t idx );
+/*
+ * Append all elements of 'tail' to 'tree', 'tail' becomes empty.
+ */
+void SQ_concat( const SQTree tree, const SQTree tail );
+/*
+ * Reverse elements [from, to).
+ */
+int SQ_reverse_range( const SQTree tree, size_t from, size_t to );
+
+void SQ_walk( const SQTree tree, SQ_Walk walker, void *data );
+int SQ_dump( const SQTree tree, Tree_DataDump ddumper, FILE *handle );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQTREE_H_ */
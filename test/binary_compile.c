@@ -0,0 +1,226 @@
+/*
+ * binary_compile.c, part of "trees" project.
+ *
+ *  Binary keys (with zero bytes) of ternary tree pass through TT_compile(),
+ *  TT_save() and TT_open_mapped(): searches, prefix lookups and values of
+ *  compiled and mapped trees match source tree. Truncated and damaged
+ *  files are not opened. Build from project directory:
+ *
+ *  gcc -g -O1 -I../klib -I. -o binary_compile test/binary_compile.c \
+ *      tree.c ttree.c tstree.c tftree.c -lpthread
+ *
+ *  Created on: 18.10.2026, 22:10
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "tftree.h"
+
+#define KEYS 5000
+#define PATH "binary_compile.tf"
+
+static int failed;
+
+static void _check( int ok, const char *what )
+{
+    if( !ok ) {
+        printf( "%s: FAILED\n", what );
+        failed = 1;
+    }
+}
+
+/*
+ *  Key 'n' is big-endian number of 1..8 bytes, most of them are zeros:
+ */
+static size_t _make_key( unsigned char *key, unsigned n )
+{
+    size_t len = 1 + n % 8, i;
+    unsigned v = n * 2654435761u;
+
+    for( i = 0; i < len; i++ ) {
+        key[i] = ( i + 1 == len ) ? ( unsigned char )( v >> 24 ) % 4 : 0;
+    }
+
+    if( len > 2 ) {
+        key[1] = ( unsigned char )( n >> 8 );
+    }
+
+    return len;
+}
+
+static int _serialize( const void *value, FILE *handle )
+{
+    unsigned n = ( unsigned )( size_t ) value;
+    return fwrite( &n, sizeof( n ), 1, handle ) == 1;
+}
+
+/*
+ *  Prefix lookup of compiled tree returns the same keys as source one:
+ */
+static int _same_lookup( TTree tree, TFTree flat, const void *prefix,
+                         size_t len )
+{
+    size_t n, m, i;
+    TT_DataConst a = TT_lookup_n( tree, prefix, len, &n );
+    TT_DataConst b = TF_lookup_n( flat, prefix, len, &m );
+    int rc = n == m;
+
+    for( i = 0; rc && i < n; i++ ) {
+        rc = a[i].len == b[i].len && !memcmp( a[i].key, b[i].key, a[i].len );
+
+        if( !flat->map ) {
+            rc = rc && a[i].data == b[i].data;
+        }
+    }
+
+    free( ( void * ) a );
+    free( ( void * ) b );
+    return rc;
+}
+
+static void _check_tree( TTree tree, TFTree flat, const char *what )
+{
+    static const unsigned char prefixes[][2] = { { 0, 0 }, { 0, 1 },
+        { 0, 7 }, { 1, 0 }
+    };
+    unsigned char key[8];
+    size_t i, found = 0, values = 0;
+
+    _check( flat && flat->keys == tree->keys, what );
+
+    if( !flat ) {
+        return;
+    }
+
+    for( i = 0; i < KEYS; i++ ) {
+        size_t len = _make_key( key, ( unsigned ) i );
+        TTNodeConst node = TT_search_n( tree, key, len );
+        TFNodeConst fnode = TF_search_n( flat, key, len );
+
+        found += fnode != NULL;
+
+        if( fnode && !flat->map ) {
+            values += TF_value( flat, fnode ) == node->data;
+        }
+        else if( fnode ) {
+            unsigned n;
+            memcpy( &n, TF_value( flat, fnode ), sizeof( n ) );
+            values += TF_value_size( flat, fnode ) == sizeof( n ) &&
+                      n == ( unsigned )( size_t ) node->data;
+        }
+    }
+
+    _check( found == KEYS && values == KEYS, what );
+    _check( !TF_search_n( flat, "\0\0\0\0\0\0\0\0\0", 9 ), what );
+
+    for( i = 0; i < sizeof( prefixes ) / sizeof( prefixes[0] ); i++ ) {
+        _check( _same_lookup( tree, flat, prefixes[i], 1 ) &&
+                _same_lookup( tree, flat, prefixes[i], 2 ), what );
+    }
+}
+
+/*
+ *  Write 'size' bytes of image with byte at 'pos' xored by 'mask', and try
+ *  to open it:
+ */
+static int _opens( const char *image, size_t size, size_t pos, int mask )
+{
+    FILE *handle = fopen( PATH, "wb" );
+    TFTree flat;
+    int rc;
+
+    if( !handle ) {
+        return 1;
+    }
+
+    rc = fwrite( image, 1, size, handle ) == size;
+
+    if( rc && pos < size ) {
+        fseek( handle, ( long ) pos, SEEK_SET );
+        fputc( image[pos] ^ mask, handle );
+    }
+
+    fclose( handle );
+    flat = rc ? TT_open_mapped( PATH ) : NULL;
+    TF_destroy( flat );
+    return flat != NULL;
+}
+
+static void _check_damaged( void )
+{
+    FILE *handle = fopen( PATH, "rb" );
+    char *image = NULL;
+    long size = -1;
+    size_t pos;
+    int one = 1;
+
+    if( handle && !fseek( handle, 0, SEEK_END ) ) {
+        size = ftell( handle );
+        rewind( handle );
+    }
+
+    if( size > 0 && ( image = malloc( size ) ) != NULL &&
+            fread( image, 1, size, handle ) == ( size_t ) size ) {
+        /*
+         * Header is 56 bytes: magic, byte order, then node size:
+         */
+        _check( _opens( image, size, size, 0 ), "image" );
+        _check( !_opens( image, size, 8, 0xFF ), "byte order" );
+        _check( !_opens( image, size, 12, 1 ), "node size" );
+
+        for( pos = 0; pos < ( size_t ) size; pos += 1 + pos / 8 ) {
+            _check( !_opens( image, pos, size, 0 ), "truncated" );
+        }
+
+        /*
+         * Child index of root (node bytes 8..11) points out of nodes:
+         */
+        _check( !_opens( image, size, 56 + 8 + ( *( char * ) &one ? 3 : 0 ),
+                         0x80 ), "node link" );
+    }
+    else {
+        _check( 0, "read image" );
+    }
+
+    free( image );
+
+    if( handle ) {
+        fclose( handle );
+    }
+}
+
+int main( void )
+{
+    static const Tree_Flags flags[] = { T_NO_FLAGS, T_COMPRESS };
+    unsigned char key[8];
+    size_t i, f;
+
+    for( f = 0; f < sizeof( flags ) / sizeof( flags[0] ); f++ ) {
+        TTree tree = TT_create( flags[f], NULL );
+        TFTree flat;
+
+        for( i = 0; tree && i < KEYS; i++ ) {
+            size_t len = _make_key( key, ( unsigned ) i );
+            TT_insert_n( tree, key, len, ( void * )( i + 1 ) );
+        }
+
+        if( !tree ) {
+            return 1;
+        }
+
+        flat = TT_compile( tree );
+        _check_tree( tree, flat, "compiled" );
+        TF_destroy( flat );
+
+        _check( TT_save( tree, PATH, _serialize ), "save" );
+        flat = TT_open_mapped( PATH );
+        _check_tree( tree, flat, "mapped" );
+        TF_destroy( flat );
+        _check_damaged();
+
+        remove( PATH );
+        TT_destroy( tree );
+    }
+
+    printf( "%s\n", failed ? "FAILED" : "OK" );
+    return failed;
+}
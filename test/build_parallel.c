@@ -0,0 +1,133 @@
+/*
+ * build_parallel.c, part of "trees" project.
+ *
+ *  TT_build_parallel() on skewed keys (all of them share long prefix, so
+ *  partitions are split): keys, data, node counts and prefix counters are
+ *  the same as of tree made by TT_insert(). Build from project directory:
+ *
+ *  gcc -g -O1 -I../klib -I. -o build_parallel test/build_parallel.c \
+ *      tree.c ttree.c tstree.c -lpthread
+ *
+ *  Created on: 18.10.2026, 23:20
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "ttree.h"
+
+#define KEYS 30000
+
+static int failed;
+
+static void _check( int ok, const char *what )
+{
+    if( !ok ) {
+        printf( "%s: FAILED\n", what );
+        failed = 1;
+    }
+}
+
+/*
+ *  URLs of few hosts, some of them are prefixes of others, some repeat,
+ *  and case of host differs. Few keys go to existing first level node:
+ */
+static char *_make_key( unsigned n )
+{
+    static const char *hosts[] = { "http://www.example.com/",
+                                   "http://WWW.Example.com/",
+                                   "http://www.example.org/",
+                                   "https://www.example.com/"
+                                 };
+    char key[128];
+
+    if( n % 101 == 0 ) {
+        sprintf( key, "xylophone/%u", n );
+    }
+    else if( n % 97 == 0 ) {
+        sprintf( key, "%s", hosts[n % 4] );
+    }
+    else {
+        sprintf( key, "%sitem/%u/%u", hosts[n % 4], n % 7000, n % 13 );
+    }
+
+    return strdup( key );
+}
+
+static int _same( TTree a, TTree b, const char *prefix )
+{
+    size_t n, m, i;
+    TT_DataConst x = TT_lookup( a, prefix, &n );
+    TT_DataConst y = TT_lookup( b, prefix, &m );
+    int rc = n == m;
+
+    for( i = 0; rc && i < n; i++ ) {
+        rc = !strcmp( x[i].key, y[i].key ) && x[i].data == y[i].data;
+    }
+
+    free( ( void * ) x );
+    free( ( void * ) y );
+    return rc && TT_count_prefix( a, prefix ) == TT_count_prefix( b, prefix );
+}
+
+int main( void )
+{
+    static const Tree_Flags flags[] = { T_NO_FLAGS, T_COMPRESS, T_NOCASE,
+                                        T_COMPRESS | T_NOCASE | T_COUNTS,
+                                        T_INSERT_REPLACE | T_CONCURRENT,
+                                        T_COMPRESS | T_ARENA | T_COUNTS
+                                      };
+    static const char *prefixes[] = { "", "h", "http://www.example.com/",
+                                      "http://www.example.com/item/1",
+                                      "https", "x"
+                                    };
+    const char **keys = malloc( KEYS * sizeof( char * ) );
+    void **datas = malloc( KEYS * sizeof( void * ) );
+    size_t i, f, p;
+
+    if( !keys || !datas ) {
+        return 1;
+    }
+
+    for( i = 0; i < KEYS; i++ ) {
+        keys[i] = _make_key( ( unsigned ) i );
+        datas[i] = ( void * )( i + 1 );
+    }
+
+    for( f = 0; f < sizeof( flags ) / sizeof( flags[0] ); f++ ) {
+        TTree tree = TT_create( flags[f], NULL );
+        TTree built = TT_create( flags[f], NULL );
+
+        if( !tree || !built ) {
+            return 1;
+        }
+
+        /*
+         * Keys of existing first level node are inserted by caller:
+         */
+        TT_insert( built, "xyz", NULL );
+        TT_insert( tree, "xyz", NULL );
+
+        for( i = 0; i < KEYS; i++ ) {
+            TT_insert( tree, keys[i], datas[i] );
+        }
+
+        _check( TT_build_parallel( built, keys, datas, KEYS, 4 ), "build" );
+        _check( built->keys == tree->keys, "keys" );
+        _check( built->nodes == tree->nodes, "nodes" );
+
+        for( p = 0; p < sizeof( prefixes ) / sizeof( prefixes[0] ); p++ ) {
+            _check( _same( tree, built, prefixes[p] ), prefixes[p] );
+        }
+
+        TT_destroy( built );
+        TT_destroy( tree );
+    }
+
+    for( i = 0; i < KEYS; i++ ) {
+        free( ( void * ) keys[i] );
+    }
+
+    free( keys );
+    free( datas );
+    printf( "%s\n", failed ? "FAILED" : "OK" );
+    return failed;
+}
@@ -0,0 +1,138 @@
+/*
+ * cursor_concurrent.c, part of "trees" project.
+ *
+ *  Prefix cursors and counters of T_CONCURRENT tree run in read sections
+ *  while another thread inserts, deletes and compacts (partly inside its
+ *  own read sections, writer must not wait for itself). Build (best with
+ *  -fsanitize=thread or -fsanitize=address) from project directory:
+ *
+ *  gcc -g -O1 -I../klib -I. -o cursor_concurrent test/cursor_concurrent.c \
+ *      tree.c ttree.c -lpthread
+ *
+ *  Created on: 18.10.2026, 19:30
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "ttree.h"
+
+#define READERS   4
+#define KEYS      2000
+#define ROUNDS    20000
+
+static TTree tree;
+static int done;
+static int failed;
+
+static void _make_key( char *key, unsigned n )
+{
+    sprintf( key, "%c%c%u", 'a' + n % 3, 'a' + ( n / 3 ) % 3, n % KEYS );
+}
+
+static void *_writer( void *arg )
+{
+    unsigned seed = 1, i;
+    char key[32];
+    int token;
+
+    ( void ) arg;
+
+    for( i = 0; i < ROUNDS; i++ ) {
+        seed = seed * 1103515245 + 12345;
+        _make_key( key, seed >> 8 );
+
+        switch( ( seed >> 4 ) % 8 ) {
+            case 0:
+                TT_del_key( tree, key );
+                break;
+
+            case 1:
+                TT_del_node( tree, key );
+                break;
+
+            case 2:
+                if( ( seed >> 12 ) % 64 == 0 ) {
+                    TT_compact( tree );
+                }
+
+                break;
+
+            case 3:
+                token = TT_read_begin( tree );
+                TT_insert( tree, key, NULL );
+                TT_del_node( tree, key );
+                TT_read_end( tree, token );
+                break;
+
+            default:
+                TT_insert( tree, key, NULL );
+        }
+    }
+
+    __atomic_store_n( &done, 1, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+static void *_reader( void *arg )
+{
+    static const char *prefixes[] = { "", "a", "ab", "ca1", "b" };
+    unsigned n = ( unsigned )( size_t ) arg;
+    char last[64];
+
+    while( !__atomic_load_n( &done, __ATOMIC_ACQUIRE ) ) {
+        const char *prefix = prefixes[n++ % 5];
+        size_t len = strlen( prefix );
+        TT_Cursor cursor;
+        int token = TT_read_begin( tree );
+
+        *last = 0;
+        TT_prefix_cursor( tree, prefix, &cursor );
+
+        /*
+         * Keys are started by prefix and come in ascending order:
+         */
+        while( TT_prefix_next( &cursor ) ) {
+            if( cursor.len != strlen( cursor.key ) ||
+                    strncmp( cursor.key, prefix, len ) ||
+                    strcmp( last, cursor.key ) >= 0 ) {
+                __atomic_store_n( &failed, 1, __ATOMIC_RELAXED );
+            }
+
+            strcpy( last, cursor.key );
+        }
+
+        TT_prefix_close( &cursor );
+        TT_read_end( tree, token );
+
+        TT_prefix_count( tree, prefix );
+        TT_count_prefix( tree, prefix );
+    }
+
+    return NULL;
+}
+
+int main( void )
+{
+    pthread_t readers[READERS], writer;
+    size_t i;
+
+    tree = TT_create( T_CONCURRENT | T_COMPRESS, NULL );
+
+    if( !tree ) {
+        return 1;
+    }
+
+    for( i = 0; i < READERS; i++ ) {
+        pthread_create( &readers[i], NULL, _reader, ( void * ) i );
+    }
+
+    pthread_create( &writer, NULL, _writer, NULL );
+    pthread_join( writer, NULL );
+
+    for( i = 0; i < READERS; i++ ) {
+        pthread_join( readers[i], NULL );
+    }
+
+    TT_destroy( tree );
+    printf( "%s\n", failed ? "FAILED" : "OK" );
+    return failed;
+}
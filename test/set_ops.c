@@ -0,0 +1,123 @@
+/*
+ * set_ops.c, part of "trees" project.
+ *
+ *  Merge, intersection and difference of T_WEIGHTS trees: keys, data and
+ *  weights of result, replaced keys included. Build from project
+ *  directory:
+ *
+ *  gcc -g -O1 -I../klib -I. -o set_ops test/set_ops.c tree.c ttree.c \
+ *      -lpthread
+ *
+ *  Created on: 18.10.2026, 21:40
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "ttree.h"
+
+static int failed;
+
+static void _check( int ok, const char *what )
+{
+    if( !ok ) {
+        printf( "%s: FAILED\n", what );
+        failed = 1;
+    }
+}
+
+/*
+ *  Key is in tree with given data and weight:
+ */
+static int _has( TTree tree, const char *key, void *data, size_t weight )
+{
+    TTNodeConst node = TT_search( tree, key );
+    return node && node->data == data && TT_weight( node ) == weight;
+}
+
+static TTree _tree( Tree_Flags flags, const char **keys, size_t *weights,
+                    char *tag )
+{
+    TTree tree = TT_create( flags | T_WEIGHTS, NULL );
+    size_t i;
+
+    for( i = 0; tree && keys[i]; i++ ) {
+        TT_insert_weight( tree, keys[i], tag, weights[i] );
+    }
+
+    return tree;
+}
+
+/*
+ *  Top key is the one of highest weight, so node maxima are right:
+ */
+static int _top( TTree tree, const char *prefix, const char *key )
+{
+    TT_DataConst top = NULL;
+    size_t n = TT_topk( tree, prefix, 1, &top );
+    int rc = n == 1 && !strcmp( top[0].key, key );
+
+    free( ( void * ) top );
+    return rc;
+}
+
+int main( void )
+{
+    static const char *a_keys[] = { "apple", "apricot", "banana", "cherry",
+                                    NULL
+                                  };
+    static size_t a_weights[] = { 50, 40, 30, 20 };
+    static const char *b_keys[] = { "apple", "banana", "berry", "date",
+                                    NULL
+                                  };
+    static size_t b_weights[] = { 0, 5, 7, 9 };
+    char a_tag[1], b_tag[1];
+    TTree dst, src, rc;
+
+    /*
+     * Replacing merge: weight of replaced key comes from 'src', zero too.
+     */
+    dst = _tree( T_INSERT_REPLACE, a_keys, a_weights, a_tag );
+    src = _tree( 0, b_keys, b_weights, b_tag );
+    _check( dst && src && TT_merge( dst, src ), "merge" );
+    _check( _has( dst, "apple", b_tag, 0 ), "replace with zero weight" );
+    _check( _has( dst, "banana", b_tag, 5 ), "replace weight" );
+    _check( _has( dst, "apricot", a_tag, 40 ), "keep weight" );
+    _check( _has( dst, "berry", b_tag, 7 ), "new key weight" );
+    _check( dst->keys == 6, "merge keys" );
+    _check( _top( dst, "ap", "apricot" ), "merge maxima" );
+    _check( _top( dst, "b", "berry" ), "merge maxima of new key" );
+    TT_destroy( dst );
+
+    /*
+     * Plain merge keeps existing keys untouched. Missing subtrees ("berry",
+     * "date") are copied whole, counters of their paths follow:
+     */
+    dst = _tree( T_COUNTS, a_keys, a_weights, a_tag );
+    _check( dst && TT_merge( dst, src ), "merge" );
+    _check( _has( dst, "apple", a_tag, 50 ), "no replace weight" );
+    _check( _has( dst, "date", b_tag, 9 ), "new key weight" );
+    _check( _top( dst, NULL, "apple" ), "plain merge maxima" );
+    _check( TT_count_prefix( dst, "b" ) == 2 &&
+            TT_count_prefix( dst, NULL ) == 6, "merge counters" );
+
+    /*
+     * Intersection and difference take keys with weights of 'a':
+     */
+    rc = TT_intersect( src, dst );
+    _check( rc && rc->keys == 4, "intersect keys" );
+    _check( rc && _has( rc, "apple", b_tag, 0 ), "intersect weight" );
+    _check( rc && _has( rc, "date", b_tag, 9 ), "intersect weight" );
+    _check( rc && _top( rc, "b", "berry" ), "intersect maxima" );
+    TT_destroy( rc );
+
+    rc = TT_diff( dst, src );
+    _check( rc && rc->keys == 2, "diff keys" );
+    _check( rc && _has( rc, "apricot", a_tag, 40 ), "diff weight" );
+    _check( rc && _has( rc, "cherry", a_tag, 20 ), "diff weight" );
+    _check( rc && !TT_search( rc, "apple" ), "diff skips keys" );
+    TT_destroy( rc );
+
+    TT_destroy( dst );
+    TT_destroy( src );
+    printf( "%s\n", failed ? "FAILED" : "OK" );
+    return failed;
+}
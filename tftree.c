@@ -0,0 +1,936 @@
+/*
+ * tftree.c, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 15:14
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "tftree.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TF_RUN_MAX  0xFFFF
+#define TF_RANKS( nodes ) ( ( ( nodes ) + 63 ) / 64 )
+#define TT_FOLD_SIZE 256
+
+size_t _TT_run( TTNodeConst node, const char **run );
+const char *_TT_fold_n( Tree_Flags flags, const char *key, size_t len,
+                        char *buf );
+void _TT_unfold( const char *key, const char *folded, const char *buf );
+
+/*
+ *  Internal, grow array to hold at least 'need' elements:
+ */
+int _TF_grow( void *ptr, size_t *size, size_t need, size_t esize )
+{
+    if( *size < need ) {
+        size_t n = *size ? *size * 2 : 256;
+        void *mem;
+
+        while( n < need ) {
+            n *= 2;
+        }
+
+        mem = Realloc( *( void ** ) ptr, n * esize );
+
+        if( !mem ) {
+            return 0;
+        }
+
+        *( void ** ) ptr = mem;
+        *size = n;
+    }
+
+    return 1;
+}
+
+/*
+ *  Internal, get children of node:
+ */
+static TFNodeConst _TF_left( const TFTree tree, TFNodeConst node )
+{
+    return ( node->flags & TF_LEFT ) ? tree->node + node->child : NULL;
+}
+static TFNodeConst _TF_right( const TFTree tree, TFNodeConst node )
+{
+    return ( node->flags & TF_RIGHT ) ? tree->node + node->child +
+           ( ( node->flags & TF_LEFT ) ? 1 : 0 ) : NULL;
+}
+static TFNodeConst _TF_mid( const TFTree tree, TFNodeConst node )
+{
+    return ( node->flags & TF_MID ) ? tree->node + node->child +
+           ( ( node->flags & TF_LEFT ) ? 1 : 0 ) +
+           ( ( node->flags & TF_RIGHT ) ? 1 : 0 ) : NULL;
+}
+
+/*
+ *  Internal, get value index (rank) of key node:
+ */
+static size_t _TF_value( const TFTree tree, TFNodeConst node )
+{
+    size_t idx = ( size_t )( node - tree->node );
+    const struct _TFRank *rank = tree->rank + idx / 64;
+    uint64_t mask = ( ( uint64_t ) 1 << ( idx % 64 ) ) - 1;
+    return ( size_t ) rank->count + __builtin_popcountll( rank->bits & mask );
+}
+
+/*
+ *  Compile stuff. Nodes are emitted in breadth-first order, so each level
+ *  lies close in memory, and children of every node are emitted together.
+ *  Key nodes get values in the same order, so value index is key rank.
+ *  Runs longer than TF_RUN_MAX are stored as chains of nodes, 'pos' is the
+ *  offset of node own run in source node run.
+ */
+struct _TF_Source {
+    TTNodeConst node;
+    size_t pos;
+};
+
+struct _TF_Compile {
+    TFTree tree;
+    struct _TF_Source *src;
+    size_t nsize;
+    size_t ssize;
+    size_t bsize;
+    size_t vsize;
+};
+
+static int _TF_emit( struct _TF_Compile *cc, TTNodeConst node, size_t pos )
+{
+    TFTree tree = cc->tree;
+    TFNode fnode;
+    const char *run;
+    size_t rlen = _TT_run( node, &run );
+    size_t len = rlen - pos;
+
+    if( tree->nodes >= UINT32_MAX ||
+            !_TF_grow( &tree->node, &cc->nsize, tree->nodes + 1,
+                       sizeof( struct _TFNode ) ) ||
+            !_TF_grow( &cc->src, &cc->ssize, tree->nodes + 1,
+                       sizeof( struct _TF_Source ) ) ) {
+        return 0;
+    }
+
+    if( len > TF_RUN_MAX ) {
+        len = TF_RUN_MAX;
+    }
+
+    fnode = tree->node + tree->nodes;
+    memset( fnode, 0, sizeof( struct _TFNode ) );
+    fnode->splitter = pos ? run[pos - 1] : node->splitter;
+
+    if( len ) {
+        if( tree->bytes + len > UINT32_MAX ||
+                !_TF_grow( &tree->run, &cc->bsize, tree->bytes + len, 1 ) ) {
+            return 0;
+        }
+
+        memcpy( tree->run + tree->bytes, run + pos, len );
+        fnode->run = tree->bytes;
+        fnode->len = len;
+        tree->bytes += len;
+    }
+
+    if( pos + len == rlen && ( node->flags & TN_KEY ) ) {
+        if( !_TF_grow( &tree->values, &cc->vsize, tree->keys + 1,
+                       sizeof( void * ) ) ) {
+            return 0;
+        }
+
+        fnode->flags = TN_KEY;
+        tree->values[tree->keys++] = node->data;
+    }
+
+    cc->src[tree->nodes].node = node;
+    cc->src[tree->nodes].pos = pos;
+    tree->nodes++;
+    return 1;
+}
+
+static int _TF_compile( struct _TF_Compile *cc, TTNodeConst root )
+{
+    TFTree tree = cc->tree;
+    size_t i;
+
+    if( !root ) {
+        return 1;
+    }
+
+    if( !_TF_emit( cc, root, 0 ) ) {
+        return 0;
+    }
+
+    for( i = 0; i < tree->nodes; i++ ) {
+        struct _TF_Source src = cc->src[i];
+        const char *run;
+        size_t rlen = _TT_run( src.node, &run );
+        size_t end = src.pos + tree->node[i].len;
+        unsigned char flags = 0;
+
+        tree->node[i].child = ( uint32_t ) tree->nodes;
+
+        if( !src.pos && src.node->left ) {
+            if( !_TF_emit( cc, src.node->left, 0 ) ) {
+                return 0;
+            }
+
+            flags |= TF_LEFT;
+        }
+
+        if( !src.pos && src.node->right ) {
+            if( !_TF_emit( cc, src.node->right, 0 ) ) {
+                return 0;
+            }
+
+            flags |= TF_RIGHT;
+        }
+
+        if( end < rlen ) {
+            if( !_TF_emit( cc, src.node, end + 1 ) ) {
+                return 0;
+            }
+
+            flags |= TF_MID;
+        }
+        else if( src.node->mid ) {
+            if( !_TF_emit( cc, src.node->mid, 0 ) ) {
+                return 0;
+            }
+
+            flags |= TF_MID;
+        }
+
+        tree->node[i].flags |= flags;
+
+        if( !flags ) {
+            tree->node[i].child = 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ *  Internal, build rank directory of key nodes:
+ */
+static int _TF_rank( TFTree tree )
+{
+    size_t i, count = 0;
+
+    if( !tree->nodes ) {
+        return 1;
+    }
+
+    tree->rank = Calloc( sizeof( struct _TFRank ), TF_RANKS( tree->nodes ) );
+
+    if( !tree->rank ) {
+        return 0;
+    }
+
+    for( i = 0; i < tree->nodes; i++ ) {
+        TFRank rank = tree->rank + i / 64;
+
+        if( !( i % 64 ) ) {
+            rank->count = count;
+        }
+
+        if( tree->node[i].flags & TN_KEY ) {
+            rank->bits |= ( uint64_t ) 1 << ( i % 64 );
+            count++;
+        }
+    }
+
+    return 1;
+}
+
+TFTree TT_compile( const TTree tree )
+{
+    struct _TF_Compile cc;
+    int rc;
+
+    if( !tree || !tree->head ) {
+        return NULL;
+    }
+
+    memset( &cc, 0, sizeof( struct _TF_Compile ) );
+    cc.tree = Calloc( sizeof( struct _TFTree ), 1 );
+
+    if( !cc.tree ) {
+        return NULL;
+    }
+
+    cc.tree->flags = tree->flags;
+    __lock( tree->lock );
+    rc = _TF_compile( &cc, tree->head->mid );
+    __unlock( tree->lock );
+    Free( cc.src );
+    rc = rc && _TF_rank( cc.tree );
+
+    if( !rc ) {
+        TF_destroy( cc.tree );
+        return NULL;
+    }
+
+    /*
+     * Shrink arrays to exact size:
+     */
+    if( cc.tree->nodes ) {
+        void *mem = Realloc( cc.tree->node,
+                             cc.tree->nodes * sizeof( struct _TFNode ) );
+        cc.tree->node = mem ? mem : cc.tree->node;
+    }
+
+    if( cc.tree->bytes ) {
+        void *mem = Realloc( cc.tree->run, cc.tree->bytes );
+        cc.tree->run = mem ? mem : cc.tree->run;
+    }
+
+    if( cc.tree->keys ) {
+        void *mem = Realloc( cc.tree->values, cc.tree->keys * sizeof( void * ) );
+        cc.tree->values = mem ? mem : cc.tree->values;
+    }
+
+    return cc.tree;
+}
+
+void TF_destroy( TFTree tree )
+{
+    if( tree ) {
+        if( tree->map ) {
+            munmap( tree->map, tree->msize );
+        }
+        else {
+            Free( tree->node );
+            Free( tree->rank );
+            Free( tree->run );
+            Free( tree->values );
+        }
+
+        memset( tree, 0, sizeof( struct _TFTree ) );
+        Free( tree );
+    }
+}
+
+size_t TF_size( const TFTree tree )
+{
+    if( tree && tree->map ) {
+        return sizeof( struct _TFTree ) + tree->msize;
+    }
+
+    return tree ? sizeof( struct _TFTree ) +
+           tree->nodes * sizeof( struct _TFNode ) +
+           TF_RANKS( tree->nodes ) * sizeof( struct _TFRank ) + tree->bytes +
+           tree->keys * sizeof( void * ) : 0;
+}
+
+/*
+ *  Search stuff, see __TT_lookup(). Key is folded once, before walking.
+ */
+static TFNodeConst _TF_follow( const TFTree tree, const char *key,
+                               size_t len, size_t *off )
+{
+    const unsigned char *s = ( const unsigned char * ) key, *end = s + len;
+    TFNodeConst node = tree->nodes ? tree->node : NULL;
+
+    if( !s || !len ) {
+        return NULL;
+    }
+
+    while( node ) {
+        if( *s < node->splitter ) {
+            node = _TF_left( tree, node );
+        }
+        else if( *s > node->splitter ) {
+            node = _TF_right( tree, node );
+        }
+        else {
+            const char *run = tree->run + node->run;
+            size_t i = 0;
+            s++;
+
+            while( i < node->len && s < end &&
+                    *s == ( unsigned char ) run[i] ) {
+                i++;
+                s++;
+            }
+
+            if( s == end ) {
+                *off = i;
+                return node;
+            }
+
+            if( i < node->len ) {
+                return NULL;
+            }
+
+            node = _TF_mid( tree, node );
+        }
+    }
+
+    return NULL;
+}
+
+static TFNodeConst _TF_lookup( const TFTree tree, const char *s, size_t len,
+                               size_t *off )
+{
+    char buf[TT_FOLD_SIZE];
+    const char *key = _TT_fold_n( tree->flags, s, len, buf );
+    TFNodeConst node = _TF_follow( tree, key, len, off );
+    _TT_unfold( s, key, buf );
+    return node;
+}
+
+TFNodeConst TF_search_n( const TFTree tree, const void *key, size_t len )
+{
+    TFNodeConst node;
+    size_t off;
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    node = _TF_lookup( tree, key, len, &off );
+    return ( node && off == node->len && ( node->flags & TN_KEY ) ) ?
+           node : NULL;
+}
+TFNodeConst TF_search( const TFTree tree, const char *key )
+{
+    return TF_search_n( tree, key, key ? strlen( key ) : 0 );
+}
+
+void *TF_value( const TFTree tree, TFNodeConst node )
+{
+    size_t value;
+
+    if( !( node->flags & TN_KEY ) ) {
+        return NULL;
+    }
+
+    value = _TF_value( tree, node );
+
+    if( tree->map ) {
+        return tree->blob ? ( void * )( tree->blob + tree->offsets[value] ) :
+               NULL;
+    }
+
+    return tree->values[value];
+}
+size_t TF_value_size( const TFTree tree, TFNodeConst node )
+{
+    size_t value;
+
+    if( !tree->blob || !( node->flags & TN_KEY ) ) {
+        return 0;
+    }
+
+    value = _TF_value( tree, node );
+    return tree->offsets[value + 1] - tree->offsets[value];
+}
+
+/*
+ *  Rebuild keys from path stuff:
+ */
+struct _TF_Keys {
+    char *key;
+    size_t len;
+    size_t size;
+};
+
+static int _TF_keys_append( struct _TF_Keys *keys, const char *s, size_t len )
+{
+    if( !_TF_grow( &keys->key, &keys->size, keys->len + len + 1, 1 ) ) {
+        return 0;
+    }
+
+    if( len ) {
+        memcpy( keys->key + keys->len, s, len );
+        keys->len += len;
+    }
+
+    keys->key[keys->len] = 0;
+    return 1;
+}
+
+static int _TF_walk_keys( const TFTree tree, TFNodeConst node,
+                          struct _TF_Keys *keys, TF_KeyWalk walker, void *data )
+{
+    int rc;
+
+    if( !node ) {
+        return 0;
+    }
+
+    if( _TF_walk_keys( tree, _TF_left( tree, node ), keys, walker, data ) ) {
+        return 1;
+    }
+
+    if( !_TF_keys_append( keys, ( const char * ) &node->splitter, 1 ) ||
+            !_TF_keys_append( keys, tree->run + node->run, node->len ) ) {
+        return 1;
+    }
+
+    rc = ( node->flags & TN_KEY ) ?
+         walker( keys->key, keys->len, TF_value( tree, node ), data ) : 0;
+
+    if( !rc ) {
+        rc = _TF_walk_keys( tree, _TF_mid( tree, node ), keys, walker, data );
+    }
+
+    keys->len -= node->len + 1;
+    keys->key[keys->len] = 0;
+    return rc ? rc : _TF_walk_keys( tree, _TF_right( tree, node ), keys,
+                                    walker, data );
+}
+
+/*
+ *  Walk keys extending position (node, off), same as TT prefix cursor:
+ */
+static int _TF_walk_pos( const TFTree tree, TFNodeConst node, size_t off,
+                         struct _TF_Keys *keys, TF_KeyWalk walker, void *data )
+{
+    size_t len = node->len - off;
+    int rc;
+
+    if( !len ) {
+        return _TF_walk_keys( tree, _TF_mid( tree, node ), keys, walker, data );
+    }
+
+    if( !_TF_keys_append( keys, tree->run + node->run + off, len ) ) {
+        return 1;
+    }
+
+    rc = ( node->flags & TN_KEY ) ?
+         walker( keys->key, keys->len, TF_value( tree, node ), data ) : 0;
+
+    if( !rc ) {
+        rc = _TF_walk_keys( tree, _TF_mid( tree, node ), keys, walker, data );
+    }
+
+    keys->len -= len;
+    keys->key[keys->len] = 0;
+    return rc;
+}
+
+int TF_walk_keys( const TFTree tree, TF_KeyWalk walker, void *data )
+{
+    struct _TF_Keys keys =
+    { 0 };
+    int rc;
+
+    if( !tree || !tree->nodes ) {
+        return 1;
+    }
+
+    rc = !_TF_walk_keys( tree, tree->node, &keys, walker, data );
+    Free( keys.key );
+    return rc;
+}
+
+/*
+ *  Lookup stuff, see _TT_collect():
+ */
+struct _TF_Collect {
+    size_t max;
+    size_t idx;
+    size_t size;
+    TT_Data data;
+    char *ptr;
+};
+
+static int _TF_collect_count( const char *key, size_t len, void *value,
+                              void *data )
+{
+    struct _TF_Collect *ptr = data;
+    ( void ) key;
+    ( void ) value;
+    ptr->idx++;
+    ptr->size += len + 1;
+    return ptr->idx >= ptr->max;
+}
+
+static int _TF_collect_fill( const char *key, size_t len, void *value,
+                             void *data )
+{
+    struct _TF_Collect *ptr = data;
+    memcpy( ptr->ptr, key, len + 1 );
+    ptr->data[ptr->idx].key = ptr->ptr;
+    ptr->data[ptr->idx].data = value;
+    ptr->data[ptr->idx].len = len;
+    ptr->ptr += len + 1;
+    ptr->idx++;
+    return ptr->idx >= ptr->max;
+}
+
+static TT_DataConst _TF_nlookup( const TFTree tree, const char *prefix,
+                                 size_t len, size_t max, size_t *count )
+{
+    struct _TF_Collect data =
+    { 0 };
+    struct _TF_Keys keys =
+    { 0 };
+    TFNodeConst node;
+    size_t off;
+
+    if( count ) {
+        *count = 0;
+    }
+
+    if( !tree || !prefix || !len ) {
+        return NULL;
+    }
+
+    node = _TF_lookup( tree, prefix, len, &off );
+
+    if( !node || ( off == node->len && !( node->flags & TF_MID ) ) ) {
+        return NULL;
+    }
+
+    if( !_TF_keys_append( &keys, prefix, len ) ) {
+        return NULL;
+    }
+
+    if( tree->flags & T_NOCASE ) {
+        T_Fold( keys.key, keys.key, len );
+    }
+
+    data.max = max ? max : ( ( size_t ) - 1 );
+    _TF_walk_pos( tree, node, off, &keys, _TF_collect_count, &data );
+    data.data = Calloc( sizeof( struct _TT_Data ) * ( data.idx + 1 ) +
+                        data.size, 1 );
+
+    if( data.data && data.idx ) {
+        data.ptr = ( char * )( data.data + data.idx + 1 );
+        data.max = data.idx;
+        data.idx = 0;
+        _TF_walk_pos( tree, node, off, &keys, _TF_collect_fill, &data );
+    }
+
+    Free( keys.key );
+
+    if( data.data && count ) {
+        *count = data.idx;
+    }
+
+    return data.data;
+}
+
+TT_DataConst TF_lookup( const TFTree tree, const char *prefix, size_t *count )
+{
+    return _TF_nlookup( tree, prefix, prefix ? strlen( prefix ) : 0, 0,
+                        count );
+}
+TT_DataConst TF_nlookup( const TFTree tree, const char *prefix, size_t max,
+                         size_t *count )
+{
+    return _TF_nlookup( tree, prefix, prefix ? strlen( prefix ) : 0, max,
+                        count );
+}
+TT_DataConst TF_lookup_n( const TFTree tree, const void *prefix, size_t len,
+                          size_t *count )
+{
+    return _TF_nlookup( tree, prefix, len, 0, count );
+}
+TT_DataConst TF_nlookup_n( const TFTree tree, const void *prefix, size_t len,
+                           size_t max, size_t *count )
+{
+    return _TF_nlookup( tree, prefix, len, max, count );
+}
+
+/*
+ *  Save and map stuff. File image is header, nodes, rank directory, run
+ *  pool, then (if values are saved) keys + 1 value offsets and values
+ *  blob. All positions are indexes or offsets, so image is searched right
+ *  in read-only mapping. Numbers are in host byte order, 'order' field
+ *  holds TF_ORDER to tell it, 'size' is node size.
+ */
+#define TF_MAGIC "TFTREE3"
+#define TF_ORDER 0x01020304
+#define TF_ALIGN( n ) ( ( ( n ) + 7 ) & ~( ( size_t ) 7 ) )
+
+struct _TF_Header {
+    char magic[8];
+    uint32_t order;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t values;
+    uint64_t keys;
+    uint64_t nodes;
+    uint64_t bytes;
+    uint64_t blob;
+};
+
+static size_t _TF_ranks( const struct _TF_Header *header )
+{
+    return TF_ALIGN( sizeof( struct _TF_Header ) +
+                     header->nodes * sizeof( struct _TFNode ) );
+}
+static size_t _TF_runs( const struct _TF_Header *header )
+{
+    return _TF_ranks( header ) +
+           TF_RANKS( header->nodes ) * sizeof( struct _TFRank );
+}
+static size_t _TF_offsets( const struct _TF_Header *header )
+{
+    return TF_ALIGN( _TF_runs( header ) + header->bytes );
+}
+
+static int _TF_pad( FILE *handle )
+{
+    long pos = ftell( handle );
+
+    while( pos >= 0 && ( pos & 7 ) ) {
+        if( fputc( 0, handle ) == EOF ) {
+            return 0;
+        }
+
+        pos++;
+    }
+
+    return pos >= 0;
+}
+
+int TF_save( const TFTree tree, const char *path, TF_Serializer serializer )
+{
+    struct _TF_Header header;
+    uint64_t *offsets = NULL;
+    FILE *handle;
+    size_t i;
+    int rc;
+
+    if( !tree || !path ) {
+        return 0;
+    }
+
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, TF_MAGIC, sizeof( TF_MAGIC ) );
+    header.order = TF_ORDER;
+    header.size = sizeof( struct _TFNode );
+    header.flags = tree->flags;
+    header.values = serializer ? 1 : 0;
+    header.keys = tree->keys;
+    header.nodes = tree->nodes;
+    header.bytes = tree->bytes;
+
+    if( serializer ) {
+        offsets = Calloc( sizeof( uint64_t ), tree->keys + 1 );
+
+        if( !offsets ) {
+            return 0;
+        }
+    }
+
+    handle = fopen( path, "wb" );
+
+    if( !handle ) {
+        Free( offsets );
+        return 0;
+    }
+
+    rc = fwrite( &header, sizeof( header ), 1, handle ) == 1 &&
+         ( !tree->nodes ||
+           ( fwrite( tree->node, sizeof( struct _TFNode ), tree->nodes,
+                     handle ) == tree->nodes && _TF_pad( handle ) &&
+             fwrite( tree->rank, sizeof( struct _TFRank ),
+                     TF_RANKS( tree->nodes ),
+                     handle ) == TF_RANKS( tree->nodes ) ) ) &&
+         ( !tree->bytes ||
+           fwrite( tree->run, 1, tree->bytes, handle ) == tree->bytes ) &&
+         _TF_pad( handle );
+
+    /*
+     * Offsets are written after the blob, when they are known:
+     */
+    if( rc && serializer ) {
+        long start = ( long )( _TF_offsets( &header ) +
+                               ( tree->keys + 1 ) * sizeof( uint64_t ) );
+        rc = !fseek( handle, start, SEEK_SET );
+
+        for( i = 0; rc && i < tree->keys; i++ ) {
+            rc = serializer( tree->values[i], handle );
+            offsets[i + 1] = ( uint64_t )( ftell( handle ) - start );
+        }
+
+        header.blob = offsets[tree->keys];
+        rc = rc && !fseek( handle, ( long ) _TF_offsets( &header ), SEEK_SET ) &&
+             fwrite( offsets, sizeof( uint64_t ), tree->keys + 1,
+                     handle ) == tree->keys + 1 &&
+             !fseek( handle, 0, SEEK_SET ) &&
+             fwrite( &header, sizeof( header ), 1, handle ) == 1;
+    }
+
+    Free( offsets );
+
+    if( fclose( handle ) ) {
+        rc = 0;
+    }
+
+    if( !rc ) {
+        remove( path );
+    }
+
+    return rc;
+}
+
+int TT_save( const TTree tree, const char *path, TF_Serializer serializer )
+{
+    TFTree flat = TT_compile( tree );
+    int rc = flat ? TF_save( flat, path, serializer ) : 0;
+    TF_destroy( flat );
+    return rc;
+}
+
+/*
+ *  Internal, check header of mapped file and get image size it needs.
+ *  Return 0 if header is bad.
+ */
+static size_t _TF_check_header( const struct _TF_Header *header,
+                                size_t msize )
+{
+    size_t need;
+
+    if( memcmp( header->magic, TF_MAGIC, sizeof( TF_MAGIC ) ) ||
+            header->order != TF_ORDER ||
+            header->size != sizeof( struct _TFNode ) || header->values > 1 ||
+            header->nodes > UINT32_MAX ||
+            header->nodes > msize / sizeof( struct _TFNode ) ||
+            header->bytes > UINT32_MAX || header->bytes > msize ||
+            header->keys > header->nodes || header->blob > msize ||
+            ( !header->values && header->blob ) ) {
+        return 0;
+    }
+
+    need = _TF_offsets( header );
+
+    if( header->values ) {
+        need += ( header->keys + 1 ) * sizeof( uint64_t ) + header->blob;
+    }
+
+    return need;
+}
+
+/*
+ *  Internal, check that nodes, rank directory and value offsets of mapped
+ *  tree stay inside the image. Children always follow parent (nodes are in
+ *  level order), so no search or walk can loop. Return 0 if image is bad.
+ */
+static int _TF_check( const TFTree tree, uint64_t blob )
+{
+    size_t i, keys = 0;
+    uint64_t bits = 0;
+
+    for( i = 0; i < tree->nodes; i++ ) {
+        TFNodeConst node = tree->node + i;
+        size_t children = ( ( node->flags & TF_LEFT ) ? 1 : 0 ) +
+                          ( ( node->flags & TF_RIGHT ) ? 1 : 0 ) +
+                          ( ( node->flags & TF_MID ) ? 1 : 0 );
+
+        if( ( node->flags & ~( TN_KEY | TF_LEFT | TF_RIGHT | TF_MID ) ) ||
+                ( size_t ) node->run + node->len > tree->bytes ||
+                ( children && ( node->child <= i ||
+                                node->child + children > tree->nodes ) ) ) {
+            return 0;
+        }
+
+        if( !( i % 64 ) ) {
+            if( tree->rank[i / 64].count != keys ) {
+                return 0;
+            }
+
+            bits = 0;
+        }
+
+        if( node->flags & TN_KEY ) {
+            bits |= ( uint64_t ) 1 << ( i % 64 );
+            keys++;
+        }
+
+        if( i % 64 == 63 || i + 1 == tree->nodes ) {
+            if( tree->rank[i / 64].bits != bits ) {
+                return 0;
+            }
+        }
+    }
+
+    if( keys != tree->keys ) {
+        return 0;
+    }
+
+    if( tree->offsets ) {
+        if( tree->offsets[0] ) {
+            return 0;
+        }
+
+        for( i = 0; i < keys; i++ ) {
+            if( tree->offsets[i + 1] < tree->offsets[i] ) {
+                return 0;
+            }
+        }
+
+        if( tree->offsets[keys] != blob ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+TFTree TT_open_mapped( const char *path )
+{
+    const struct _TF_Header *header;
+    struct stat st;
+    TFTree tree;
+    size_t need;
+    void *map;
+    int fd = open( path, O_RDONLY );
+
+    if( fd < 0 ) {
+        return NULL;
+    }
+
+    if( fstat( fd, &st ) || ( size_t ) st.st_size < sizeof( *header ) ) {
+        close( fd );
+        return NULL;
+    }
+
+    map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if( map == MAP_FAILED ) {
+        return NULL;
+    }
+
+    header = map;
+    need = _TF_check_header( header, st.st_size );
+    tree = ( need && need <= ( size_t ) st.st_size ) ?
+           Calloc( sizeof( struct _TFTree ), 1 ) : NULL;
+
+    if( !tree ) {
+        munmap( map, st.st_size );
+        return NULL;
+    }
+
+    tree->flags = header->flags;
+    tree->keys = header->keys;
+    tree->nodes = header->nodes;
+    tree->bytes = header->bytes;
+    tree->node = ( TFNode )( header + 1 );
+    tree->rank = ( TFRank )( ( char * ) map + _TF_ranks( header ) );
+    tree->run = ( char * ) map + _TF_runs( header );
+    tree->map = map;
+    tree->msize = st.st_size;
+
+    if( header->values ) {
+        tree->offsets = ( const uint64_t * )( ( const char * ) map +
+                                              _TF_offsets( header ) );
+        tree->blob = ( const char * )( tree->offsets + tree->keys + 1 );
+    }
+
+    if( !_TF_check( tree, header->blob ) ) {
+        TF_destroy( tree );
+        return NULL;
+    }
+
+    return tree;
+}
@@ -0,0 +1,136 @@
+/*
+ * tftree.h, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 15:10
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+/*
+ * Flat (compiled) ternary tree: immutable copy of TTree stored in one
+ * contiguous array of 12-byte nodes in level order, with run bytes in
+ * separate pool. Used for read-only serving, no locks are needed.
+ */
+
+#ifndef TFTREE_H_
+#define TFTREE_H_
+
+#include "ttree.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ *  Children of node are adjacent (left, right, then mid), 'child' is index
+ *  of the first one, and flags tell which of them exist. Node has no value
+ *  field: value index of key node is its rank among key nodes.
+ */
+#define TF_LEFT  2
+#define TF_RIGHT 4
+#define TF_MID   8
+
+typedef struct _TFNode {
+    unsigned char splitter;
+    unsigned char flags;
+    uint16_t len;
+    uint32_t run;
+    uint32_t child;
+} *TFNode;
+
+/*
+ *  Rank directory: 'bits' marks key nodes of block of 64 nodes, 'count' is
+ *  number of key nodes before block.
+ */
+typedef struct _TFRank {
+    uint64_t bits;
+    uint64_t count;
+} *TFRank;
+
+typedef struct _TFNode const *TFNodeConst;
+
+typedef int ( *TF_KeyWalk )( const char *key, size_t len, void *value,
+                             void *data );
+
+/*
+ *  Value serializer for TF_save(): write value to handle, return 0 if
+ *  operation fails, or 1.
+ */
+typedef int ( *TF_Serializer )( const void *value, FILE *handle );
+
+typedef struct _TFTree {
+    Tree_Flags flags;
+    size_t keys;
+    size_t nodes;
+    size_t bytes;
+    TFNode node;
+    TFRank rank;
+    char *run;
+    void **values;
+    /*
+     * Mapped tree (TT_open_mapped()) image:
+     */
+    void *map;
+    size_t msize;
+    const uint64_t *offsets;
+    const char *blob;
+} *TFTree;
+
+/*
+ *  Compile tree to flat one. Return NULL if operation fails.
+ */
+TFTree TT_compile( const TTree tree );
+void TF_destroy( TFTree tree );
+
+/*
+ *  Save flat tree (TT_save() compiles tree first) to file. Values are
+ *  written by serializer, without serializer only keys are saved. Return 0
+ *  if operation fails (file is removed then), or 1.
+ */
+int TF_save( const TFTree tree, const char *path, TF_Serializer serializer );
+int TT_save( const TTree tree, const char *path, TF_Serializer serializer );
+/*
+ *  Map saved file read-only, nodes are used right from the mapping (pages
+ *  are shared between processes and loaded on demand). TF_value() returns
+ *  pointer to serialized value bytes (or NULL if values were not saved),
+ *  TF_value_size() returns their number. File is checked once when it is
+ *  opened (so it is read whole): header, byte order and node size, every
+ *  node link and run, rank directory and value offsets must fit the file.
+ *  File of other byte order is not opened. TF_destroy() unmaps file.
+ *  Return NULL if operation fails.
+ */
+TFTree TT_open_mapped( const char *path );
+
+/*
+ *  Same semantics as TT_search(), TT_lookup(), TT_nlookup() and
+ *  TT_walk_keys(). Use TF_value() to get data of found node.
+ */
+TFNodeConst TF_search( const TFTree tree, const char *key );
+void *TF_value( const TFTree tree, TFNodeConst node );
+size_t TF_value_size( const TFTree tree, TFNodeConst node );
+TT_DataConst TF_lookup( const TFTree tree, const char *prefix,
+                        size_t *count );
+TT_DataConst TF_nlookup( const TFTree tree, const char *prefix, size_t max,
+                         size_t *count );
+int TF_walk_keys( const TFTree tree, TF_KeyWalk walker, void *data );
+/*
+ *  Binary keys, same as TT_search_n(), TT_lookup_n() and TT_nlookup_n():
+ *  key is 'len' bytes which may include zeros.
+ */
+TFNodeConst TF_search_n( const TFTree tree, const void *key, size_t len );
+TT_DataConst TF_lookup_n( const TFTree tree, const void *prefix, size_t len,
+                          size_t *count );
+TT_DataConst TF_nlookup_n( const TFTree tree, const void *prefix, size_t len,
+                           size_t max, size_t *count );
+
+/*
+ *  Get memory used by tree.
+ */
+size_t TF_size( const TFTree tree );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TFTREE_H_ */
@@ -42,7 +42,7 @@ typedef enum _Tree_Flags
      */
     T_FREE_DEFAULT = 2,
     /*
-     * Caseless comparison for TS_Tree data:
+     * Caseless comparison for TS_Tree data (ASCII and UTF-8, see T_Fold()):
      */
     T_NOCASE = 1024,
     /*
@@ -50,6 +50,37 @@ typedef enum _Tree_Flags
      * Without - link to created/replaced node.
      */
     T_INSERT_FAST = 2096,
+    /*
+     * Compressed ternary trees: single-child chains are collapsed into one
+     * node holding bytes run.
+     */
+    T_COMPRESS = 4096,
+    /*
+     * Weighted ternary trees: keys have weights, nodes keep maximum weight
+     * of their subtrees (see TT_topk()).
+     */
+    T_WEIGHTS = 8192,
+    /*
+     * Concurrent ternary trees: readers do not take the lock, deleted and
+     * replaced nodes (and data) are freed after readers leave.
+     */
+    T_CONCURRENT = 16384,
+    /*
+     * Ternary trees nodes are allocated from tree arena and freed all at
+     * once by TT_clear() / TT_destroy():
+     */
+    T_ARENA = 32768,
+    /*
+     * Compressed ternary trees reference bytes runs in inserted keys memory
+     * instead of copying them, keys must not be changed or freed while tree
+     * is used (T_NOCASE keys are still copied):
+     */
+    T_STATIC_KEYS = 65536,
+    /*
+     * Ternary trees nodes keep number of keys in their subtrees, so keys
+     * started by prefix are counted without walking them:
+     */
+    T_COUNTS = 131072,
     T_DEFAULT_FLAGS = ( T_INSERT_REPLACE | T_FREE_DEFAULT ),
     T_NO_FLAGS = 0
 }
@@ -83,6 +114,15 @@ size_t T_Indent( char *indent, int last, FILE *handle );
  */
 void T_Free( void *data );
 
+/*
+ * Case folding (T_NOCASE flag). T_FoldTable folds ASCII bytes. T_Fold()
+ * folds 'len' bytes of 'src' to 'dst' (may be the same buffer), also
+ * handling two-byte UTF-8 letters (Latin-1, Latin Extended-A, Greek,
+ * Cyrillic). Folded string always has the same length, which is returned.
+ */
+extern const unsigned char T_FoldTable[256];
+size_t T_Fold( char *dst, const char *src, size_t len );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,415 @@
+/*
+ * tscanner.c, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 18:10
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+#include "tscanner.h"
+
+int _TF_grow( void *ptr, size_t *size, size_t need, size_t esize );
+
+/*
+ *  Build stuff. Keys come in ascending order, so each key shares states of
+ *  the common prefix with previous key ('path') and appends the rest. Then
+ *  children of every state are created in ascending byte order, and edges
+ *  grouped by parent are sorted.
+ */
+struct _SC_State {
+    uint32_t parent;
+    uint32_t match;
+    unsigned char byte;
+};
+
+struct _SC_Build {
+    TTScanner scanner;
+    struct _SC_State *state;
+    size_t ssize;
+    uint32_t *path;
+    size_t psize;
+    size_t ksize;
+    size_t csize;
+};
+
+static int _SC_add( struct _SC_Build *build, const char *key, size_t len,
+                    void *value )
+{
+    TTScanner scanner = build->scanner;
+    size_t i = 0;
+
+    if( !_TF_grow( &build->path, &build->psize, len + 1, sizeof( uint32_t ) ) ||
+            !_TF_grow( &scanner->key, &build->ksize, scanner->keys + 1,
+                       sizeof( struct _TT_ScanKey ) ) ||
+            !_TF_grow( &scanner->blob, &build->csize, scanner->chars + len + 1,
+                       1 ) ) {
+        return 1;
+    }
+
+    if( scanner->keys ) {
+        struct _TT_ScanKey *last = &scanner->key[scanner->keys - 1];
+
+        while( i < len && i < last->len &&
+                key[i] == scanner->blob[last->offset + i] ) {
+            i++;
+        }
+    }
+
+    for( ; i < len; i++ ) {
+        struct _SC_State *state;
+
+        if( scanner->states >= UINT32_MAX ||
+                !_TF_grow( &build->state, &build->ssize, scanner->states + 1,
+                           sizeof( struct _SC_State ) ) ) {
+            return 1;
+        }
+
+        state = &build->state[scanner->states];
+        state->parent = build->path[i];
+        state->match = 0;
+        state->byte = ( unsigned char ) key[i];
+        build->path[i + 1] = ( uint32_t ) scanner->states++;
+    }
+
+    build->state[build->path[len]].match = ( uint32_t )( scanner->keys + 1 );
+    scanner->key[scanner->keys].offset = scanner->chars;
+    scanner->key[scanner->keys].len = len;
+    scanner->key[scanner->keys].value = value;
+    memcpy( scanner->blob + scanner->chars, key, len );
+    scanner->blob[scanner->chars + len] = 0;
+    scanner->chars += len + 1;
+    scanner->keys++;
+    return 0;
+}
+
+static int _SC_walk_tt( const char *key, size_t len, TTNodeConst node,
+                        void *data )
+{
+    return _SC_add( data, key, len, node->data );
+}
+
+static int _SC_walk_tf( const char *key, size_t len, void *value,
+                        void *data )
+{
+    return _SC_add( data, key, len, value );
+}
+
+static int _SC_init( struct _SC_Build *build, Tree_Flags flags )
+{
+    memset( build, 0, sizeof( struct _SC_Build ) );
+    build->scanner = Calloc( sizeof( struct _TTScanner ), 1 );
+
+    if( !build->scanner ) {
+        return 0;
+    }
+
+    build->scanner->flags = flags;
+
+    /*
+     * Root state:
+     */
+    if( !_TF_grow( &build->state, &build->ssize, 1,
+                   sizeof( struct _SC_State ) ) ||
+            !_TF_grow( &build->path, &build->psize, 1, sizeof( uint32_t ) ) ) {
+        return 0;
+    }
+
+    memset( build->state, 0, sizeof( struct _SC_State ) );
+    build->path[0] = 0;
+    build->scanner->states = 1;
+    return 1;
+}
+
+/*
+ *  Internal, follow goto function from 'state' by byte, with failure links.
+ *  Edges are searched by bisection, root has direct table.
+ */
+static uint32_t _SC_step( const TTScanner scanner, uint32_t state,
+                          unsigned char c )
+{
+    while( state ) {
+        size_t lo = scanner->first[state], hi = scanner->first[state + 1];
+        size_t end = hi;
+
+        while( lo < hi ) {
+            size_t mid = lo + ( hi - lo ) / 2;
+
+            if( scanner->bytes[mid] < c ) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+
+        if( lo < end && scanner->bytes[lo] == c ) {
+            return scanner->next[lo];
+        }
+
+        state = scanner->fail[state];
+    }
+
+    return scanner->root[c];
+}
+
+/*
+ *  Internal, group edges by parent state and compute links breadth-first
+ *  (failure link of state is always shallower). Queue reuses 'out' array
+ *  space of states still not reached.
+ */
+static int _SC_link( struct _SC_Build *build )
+{
+    TTScanner scanner = build->scanner;
+    size_t i, n = scanner->states, head = 0, tail = 0;
+    uint32_t *queue;
+
+    scanner->first = Calloc( sizeof( uint32_t ), n + 1 );
+    scanner->bytes = Malloc( n );
+    scanner->next = Malloc( n * sizeof( uint32_t ) );
+    scanner->fail = Calloc( sizeof( uint32_t ), n );
+    scanner->out = Calloc( sizeof( uint32_t ), n );
+    scanner->match = Malloc( n * sizeof( uint32_t ) );
+    queue = Malloc( n * sizeof( uint32_t ) );
+
+    if( !scanner->first || !scanner->bytes || !scanner->next ||
+            !scanner->fail || !scanner->out || !scanner->match || !queue ) {
+        Free( queue );
+        return 0;
+    }
+
+    for( i = 0; i < n; i++ ) {
+        scanner->match[i] = build->state[i].match;
+    }
+
+    for( i = 1; i < n; i++ ) {
+        scanner->first[build->state[i].parent + 1]++;
+    }
+
+    for( i = 0; i < n; i++ ) {
+        scanner->first[i + 1] += scanner->first[i];
+        queue[i] = scanner->first[i];
+    }
+
+    for( i = 1; i < n; i++ ) {
+        uint32_t edge = queue[build->state[i].parent]++;
+        scanner->bytes[edge] = build->state[i].byte;
+        scanner->next[edge] = ( uint32_t ) i;
+    }
+
+    for( i = scanner->first[0]; i < scanner->first[1]; i++ ) {
+        scanner->root[scanner->bytes[i]] = scanner->next[i];
+        queue[tail++] = scanner->next[i];
+    }
+
+    while( head < tail ) {
+        uint32_t state = queue[head++];
+
+        for( i = scanner->first[state]; i < scanner->first[state + 1]; i++ ) {
+            uint32_t next = scanner->next[i];
+            uint32_t fail = _SC_step( scanner, scanner->fail[state],
+                                      scanner->bytes[i] );
+
+            scanner->fail[next] = fail;
+            scanner->out[next] = scanner->match[fail] ? fail :
+                                 scanner->out[fail];
+            queue[tail++] = next;
+        }
+    }
+
+    Free( queue );
+    return 1;
+}
+
+static TTScanner _SC_finish( struct _SC_Build *build, int rc )
+{
+    TTScanner scanner = build->scanner;
+
+    if( rc && scanner ) {
+        rc = _SC_link( build );
+    }
+
+    Free( build->state );
+    Free( build->path );
+
+    if( !rc ) {
+        TT_scanner_destroy( scanner );
+        return NULL;
+    }
+
+    return scanner;
+}
+
+TTScanner TT_scanner_build( const TTree tree )
+{
+    struct _SC_Build build;
+    int rc;
+
+    if( !tree || !tree->head ) {
+        return NULL;
+    }
+
+    rc = _SC_init( &build, tree->flags ) &&
+         TT_walk_keys( tree, _SC_walk_tt, &build );
+    return _SC_finish( &build, rc );
+}
+
+TTScanner TF_scanner_build( const TFTree tree )
+{
+    struct _SC_Build build;
+    int rc;
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    rc = _SC_init( &build, tree->flags ) &&
+         TF_walk_keys( tree, _SC_walk_tf, &build );
+    return _SC_finish( &build, rc );
+}
+
+void TT_scanner_destroy( TTScanner scanner )
+{
+    if( scanner ) {
+        Free( scanner->first );
+        Free( scanner->bytes );
+        Free( scanner->next );
+        Free( scanner->fail );
+        Free( scanner->out );
+        Free( scanner->match );
+        Free( scanner->key );
+        Free( scanner->blob );
+        memset( scanner, 0, sizeof( struct _TTScanner ) );
+        Free( scanner );
+    }
+}
+
+size_t TT_scanner_size( const TTScanner scanner )
+{
+    return scanner ? sizeof( struct _TTScanner ) +
+           ( scanner->states + 1 ) * sizeof( uint32_t ) +
+           scanner->states * ( 1 + 4 * sizeof( uint32_t ) ) +
+           scanner->keys * sizeof( struct _TT_ScanKey ) + scanner->chars : 0;
+}
+
+/*
+ *  Scan stuff. Every byte moves stream state once (failure links make
+ *  amortized constant steps), then keys ending here are reported along
+ *  output links.
+ */
+static int _SC_feed( const TTScanner scanner, TT_Scan *stream,
+                     unsigned char c, TT_ScanHit callback, void *data )
+{
+    uint32_t state = _SC_step( scanner, ( uint32_t ) stream->state, c );
+
+    stream->state = state;
+    stream->pos++;
+
+    if( !scanner->match[state] ) {
+        state = scanner->out[state];
+    }
+
+    while( state ) {
+        struct _TT_ScanKey *key = &scanner->key[scanner->match[state] - 1];
+
+        if( callback( scanner->blob + key->offset, key->len,
+                      stream->pos - key->len, key->value, data ) ) {
+            return 1;
+        }
+
+        state = scanner->out[state];
+    }
+
+    return 0;
+}
+
+void TT_scan_init( TT_Scan *stream )
+{
+    if( stream ) {
+        memset( stream, 0, sizeof( TT_Scan ) );
+    }
+}
+
+int TT_scan_chunk( const TTScanner scanner, TT_Scan *stream,
+                   const char *text, size_t len, TT_ScanHit callback,
+                   void *data )
+{
+    const unsigned char *s = ( const unsigned char * ) text, *end = s + len;
+
+    if( !scanner || !stream || !callback ) {
+        return 1;
+    }
+
+    /*
+     * End of stream, scan held byte:
+     */
+    if( !text ) {
+        unsigned char lead = ( unsigned char ) stream->lead;
+        stream->lead = 0;
+        return !lead || !_SC_feed( scanner, stream, lead, callback, data );
+    }
+
+    if( !( scanner->flags & T_NOCASE ) ) {
+        while( s < end ) {
+            if( _SC_feed( scanner, stream, *s++, callback, data ) ) {
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+    /*
+     * Fold text as T_Fold() does, two-byte letter may be split by chunks:
+     */
+    while( s < end ) {
+        unsigned char c = *s++;
+
+        if( stream->lead ) {
+            char pair[2];
+            pair[0] = ( char ) stream->lead;
+            pair[1] = ( char ) c;
+            stream->lead = 0;
+
+            if( ( c & 0xC0 ) == 0x80 ) {
+                T_Fold( pair, pair, 2 );
+
+                if( _SC_feed( scanner, stream, ( unsigned char ) pair[0],
+                              callback, data ) ||
+                        _SC_feed( scanner, stream, ( unsigned char ) pair[1],
+                                  callback, data ) ) {
+                    return 0;
+                }
+
+                continue;
+            }
+
+            if( _SC_feed( scanner, stream, ( unsigned char ) pair[0],
+                          callback, data ) ) {
+                return 0;
+            }
+        }
+
+        if( ( c & 0xE0 ) == 0xC0 ) {
+            stream->lead = c;
+        }
+        else if( _SC_feed( scanner, stream, T_FoldTable[c], callback,
+                           data ) ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int TT_scan( const TTScanner scanner, const char *text, size_t len,
+             TT_ScanHit callback, void *data )
+{
+    TT_Scan stream;
+
+    if( !text ) {
+        return 1;
+    }
+
+    TT_scan_init( &stream );
+    return TT_scan_chunk( scanner, &stream, text, len, callback, data ) &&
+           TT_scan_chunk( scanner, &stream, NULL, 0, callback, data );
+}
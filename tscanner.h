@@ -0,0 +1,112 @@
+/*
+ * tscanner.h, part of "trees" project.
+ *
+ *  Created on: 18.10.2026, 18:05
+ *      Author: Vsevolod Lutovinov <klopp@yandex.ru>
+ */
+
+/*
+ * Aho-Corasick scanner: keys of ternary tree (or of compiled one) compiled
+ * to automaton with failure and output links, which finds all keys
+ * occurring in text in one pass. Scanner is read-only, it may be shared by
+ * threads, each scanning its own stream.
+ */
+
+#ifndef TSCANNER_H_
+#define TSCANNER_H_
+
+#include "tftree.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ *  Key is 'len' bytes of 'blob' at 'offset'.
+ */
+struct _TT_ScanKey {
+    size_t offset;
+    size_t len;
+    void *value;
+};
+
+/*
+ *  State 0 is root. Edges of state 's' are 'bytes' and 'next' elements from
+ *  first[s] to first[s + 1], sorted by byte. Root edges are also in 'root'
+ *  table. Fields 'fail' and 'out' are failure link and nearest key state on
+ *  failure chain, 'match' is key index + 1 (0 if state is not key).
+ */
+typedef struct _TTScanner {
+    Tree_Flags flags;
+    size_t states;
+    size_t keys;
+    size_t chars;
+    uint32_t *first;
+    unsigned char *bytes;
+    uint32_t *next;
+    uint32_t *fail;
+    uint32_t *out;
+    uint32_t *match;
+    uint32_t root[256];
+    struct _TT_ScanKey *key;
+    char *blob;
+} *TTScanner;
+
+/*
+ *  Stream state, see TT_scan_chunk(). Field 'pos' is number of bytes
+ *  scanned.
+ */
+typedef struct _TT_Scan {
+    size_t state;
+    size_t pos;
+    unsigned lead;
+} TT_Scan;
+
+/*
+ *  Called for every key occurrence, 'pos' is key offset in stream. Key is
+ *  reported as stored (folded in T_NOCASE tree), 'value' is node data (see
+ *  TF_value() for compiled tree). Return non-zero to stop scanning.
+ */
+typedef int ( *TT_ScanHit )( const char *key, size_t len, size_t pos,
+                             void *value, void *data );
+
+/*
+ *  Build scanner from tree keys. Scanner does not reference tree, except
+ *  values. Return NULL if operation fails.
+ */
+TTScanner TT_scanner_build( const TTree tree );
+TTScanner TF_scanner_build( const TFTree tree );
+void TT_scanner_destroy( TTScanner scanner );
+
+/*
+ *  Report all keys occurring in 'len' bytes of text, in order of their
+ *  end offsets (longer key first if keys end together). Text of T_NOCASE
+ *  scanner is folded while scanned. Return 0 if callback stopped scanning,
+ *  or 1.
+ */
+int TT_scan( const TTScanner scanner, const char *text, size_t len,
+             TT_ScanHit callback, void *data );
+
+/*
+ *  Scan text given by chunks: init stream, pass chunks in order, then pass
+ *  NULL chunk to finish stream (T_NOCASE scanner may hold last byte of
+ *  chunk to fold two-byte letter). Keys across chunk bounds are found, and
+ *  offsets are counted from stream start. Return values are the same as
+ *  of TT_scan().
+ */
+void TT_scan_init( TT_Scan *stream );
+int TT_scan_chunk( const TTScanner scanner, TT_Scan *stream,
+                   const char *text, size_t len, TT_ScanHit callback,
+                   void *data );
+
+/*
+ *  Get memory used by scanner.
+ */
+size_t TT_scanner_size( const TTScanner scanner );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSCANNER_H_ */
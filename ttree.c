@@ -7,13 +7,267 @@
 #include "ttree.h"
 #include <string.h>
 #include <ctype.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*
+ *  Node of compressed tree (T_COMPRESS flag): single-child 'mid' chain after
+ *  splitter is collapsed into bytes run stored right after the node.
+ */
+typedef struct _TTRunNode {
+    struct _TTNode node;
+    char *run;
+    size_t len;
+} *TTRunNode;
+
+#define TT_RLEN( node ) \
+    ( ( __atomic_load_n( &( node )->flags, __ATOMIC_RELAXED ) & TN_RUN ) ? \
+      ( ( TTRunNode )( node ) )->len : 0 )
+#define TT_RUN( node ) ( ( TTRunNode )( node ) )->run
+
+/*
+ *  Node weights (T_WEIGHTS flag) are stored right before the node: own key
+ *  weight and maximum key weight of node subtree (left, mid and right).
+ */
+typedef struct _TTWeight {
+    size_t weight;
+    size_t max;
+} *TTWeight;
+
+#define TT_WEIGHT( node ) ( ( TTWeight )( node ) - 1 )
+#define TT_MAX( node ) ( ( node ) ? TT_WEIGHT( node )->max : 0 )
+
+/*
+ *  Keys counter (T_COUNTS flag) is stored right before the node or its
+ *  weights: number of keys in node subtree (left, mid and right). Counters
+ *  are read and written atomically, T_CONCURRENT readers may see counters
+ *  of change in progress.
+ */
+#define TT_COUNTER( node, flags ) ( ( size_t * )( ( ( flags ) & T_WEIGHTS ) ? \
+    ( void * ) TT_WEIGHT( node ) : ( void * )( node ) ) - 1 )
+#define TT_KEYS( node, flags ) ( ( node ) ? \
+    __atomic_load_n( TT_COUNTER( node, flags ), __ATOMIC_RELAXED ) : 0 )
+
+#define TT_FOLD_SIZE 256
+#define TT_PATH_SIZE 64
+
+/*
+ *  Links, flags and data of visible nodes are read with acquire loads and
+ *  written with release stores, so T_CONCURRENT readers which do not take
+ *  the lock see fully initialized nodes.
+ */
+#define TT_LOAD( ptr ) __atomic_load_n( &( ptr ), __ATOMIC_ACQUIRE )
+#define TT_STORE( ptr, value ) \
+    __atomic_store_n( &( ptr ), ( value ), __ATOMIC_RELEASE )
+
+/*
+ *  Epoch stuff (T_CONCURRENT trees). Readers count themselves in one of
+ *  striped counters of current epoch parity. Writer unlinks nodes (and
+ *  data) under the lock and retires them, retired memory is freed after
+ *  grace period: epoch is flipped and old parity counters drop to zero.
+ *  Writers never wait for readers: every TT_RETIRE_MAX retired pointers
+ *  start grace period, and it is checked (and its memory freed) by later
+ *  writes. Only TT_destroy() waits.
+ */
+#ifndef TT_STRIPES
+# define TT_STRIPES 16
+#endif
+#ifndef TT_RETIRE_MAX
+# define TT_RETIRE_MAX 64
+#endif
+
+#define TT_RETIRE_NODE 0    /* single node, links are still in use */
+#define TT_RETIRE_TREE 1    /* whole subtree with data */
+#define TT_RETIRE_DATA 2    /* node data */
+#define TT_RETIRE_BRANCH 3  /* node and its 'mid' subtree, without data */
+#define TT_RETIRE_ARENA 4   /* list of arena chunks */
+
+struct _TT_Stripe {
+    long readers[2];
+    char pad[64 - 2 * sizeof( long )];
+};
+
+struct _TT_Retired {
+    void *ptr;
+    int type;
+};
+
+/*
+ *  First 'pending' of 'count' retired pointers wait for readers of 'parity'
+ *  to leave, the rest wait for next grace period.
+ */
+struct _TT_Epoch {
+    struct _TT_Stripe stripes[TT_STRIPES];
+    unsigned long epoch;
+    int parity;
+    size_t pending;
+    size_t count;
+    size_t size;
+    struct _TT_Retired *retired;
+};
+
+/*
+ *  Arena stuff (T_ARENA trees). Nodes are bump-allocated from chunks (the
+ *  first one is current), memory of freed nodes is not reused until all
+ *  chunks are released. Only writers (under the lock) allocate.
+ */
+#ifndef TT_ARENA_CHUNK
+# define TT_ARENA_CHUNK 65536
+#endif
+#define TT_ARENA_ALIGN( n ) ( ( ( n ) + 15 ) & ~( ( size_t ) 15 ) )
+
+struct _TT_Chunk {
+    struct _TT_Chunk *next;
+    size_t used;
+    size_t size;
+};
+
+static void *_TT_arena_alloc( TTree tree, size_t size )
+{
+    struct _TT_Chunk *chunk = tree->arena;
+    size_t head = TT_ARENA_ALIGN( sizeof( struct _TT_Chunk ) );
+    char *ptr;
+
+    size = TT_ARENA_ALIGN( size );
+
+    if( !chunk || chunk->used + size > chunk->size ) {
+        size_t bytes = size > TT_ARENA_CHUNK - head ? size + head :
+                       TT_ARENA_CHUNK;
+
+        if( !( chunk = Calloc( bytes, 1 ) ) ) {
+            return NULL;
+        }
+
+        chunk->used = head;
+        chunk->size = bytes;
+
+        /*
+         * Oversized chunk does not become current:
+         */
+        if( tree->arena && bytes > TT_ARENA_CHUNK ) {
+            chunk->next = tree->arena->next;
+            tree->arena->next = chunk;
+        }
+        else {
+            chunk->next = tree->arena;
+            tree->arena = chunk;
+        }
+    }
+
+    ptr = ( char * ) chunk + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/*
+ *  Internal, add chunks to tree arena (current chunk stays current), or
+ *  move chunks of private tree there:
+ */
+static void _TT_arena_link( TTree tree, struct _TT_Chunk *chunks )
+{
+    struct _TT_Chunk *last = chunks;
+
+    if( !last ) {
+        return;
+    }
+
+    while( last->next ) {
+        last = last->next;
+    }
+
+    if( tree->arena ) {
+        last->next = tree->arena->next;
+        tree->arena->next = chunks;
+    }
+    else {
+        tree->arena = chunks;
+    }
+}
+static void _TT_arena_merge( TTree tree, TTree from )
+{
+    _TT_arena_link( tree, from->arena );
+    from->arena = NULL;
+}
+
+static void _TT_arena_free( TTree tree )
+{
+    while( tree->arena ) {
+        struct _TT_Chunk *next = tree->arena->next;
+        Free( tree->arena );
+        tree->arena = next;
+    }
+}
+
+/*
+ *  Internal, allocate node memory (with counter and weights if needed) and
+ *  free it:
+ */
+static TTNode _TT_alloc( TTree tree, size_t size )
+{
+    char *ptr;
+    TTNode node;
+    size_t head = 0;
+
+    if( tree->flags & T_COUNTS ) {
+        head += sizeof( size_t );
+    }
+
+    if( tree->flags & T_WEIGHTS ) {
+        head += sizeof( struct _TTWeight );
+    }
+
+    if( tree->flags & T_ARENA ) {
+        ptr = _TT_arena_alloc( tree, head + size );
+    }
+    else {
+        ptr = Calloc( head + size, 1 );
+    }
+
+    if( !ptr ) {
+        return NULL;
+    }
+
+    node = ( TTNode )( ptr + head );
+
+    if( tree->flags & T_WEIGHTS ) {
+        node->flags |= TN_WEIGHT;
+    }
+
+    if( tree->flags & T_COUNTS ) {
+        node->flags |= TN_COUNT;
+    }
+
+    if( tree->flags & T_ARENA ) {
+        node->flags |= TN_ARENA;
+    }
+
+    return node;
+}
+static void _TT_free( TTNode node )
+{
+    void *ptr = node;
+
+    if( node->flags & TN_ARENA ) {
+        return;
+    }
+
+    if( node->flags & TN_WEIGHT ) {
+        ptr = TT_WEIGHT( node );
+    }
+
+    if( node->flags & TN_COUNT ) {
+        ptr = ( size_t * ) ptr - 1;
+    }
+
+    Free( ptr );
+}
 
 /*
  *  Internal, create empty node:
  */
-static TTNode _TT_create_node( char c )
+static TTNode _TT_create_node( TTree tree, unsigned char c )
 {
-    TTNode node = Calloc( sizeof( struct _TTNode ), 1 );
+    TTNode node = _TT_alloc( tree, sizeof( struct _TTNode ) );
 
     if( !node ) {
         return NULL;
@@ -23,6 +277,59 @@ static TTNode _TT_create_node( char c )
     return node;
 }
 
+/*
+ *  Internal, create node with bytes run. If 'ref' is set, node references
+ *  run memory (T_STATIC_KEYS trees) instead of its copy.
+ */
+static TTNode _TT_create_run( TTree tree, unsigned char c, const char *run,
+                              size_t len, int ref )
+{
+    TTRunNode node;
+
+    if( !len ) {
+        return _TT_create_node( tree, c );
+    }
+
+    node = ( TTRunNode ) _TT_alloc( tree, sizeof( struct _TTRunNode ) +
+                                    ( ref ? 0 : len ) );
+
+    if( !node ) {
+        return NULL;
+    }
+
+    node->node.splitter = c;
+    node->node.flags |= TN_RUN;
+    node->len = len;
+
+    if( ref ) {
+        node->run = ( char * ) run;
+    }
+    else {
+        node->run = ( char * )( node + 1 );
+        memcpy( node->run, run, len );
+    }
+
+    return &node->node;
+}
+
+/*
+ *  Internal, check if node references run memory:
+ */
+static int _TT_static( TTNodeConst node )
+{
+    return ( node->flags & TN_RUN ) &&
+           TT_RUN( node ) != ( char * )( ( TTRunNode ) node + 1 );
+}
+
+/*
+ *  Get node bytes run. Return run length, 0 for plain nodes.
+ */
+size_t _TT_run( TTNodeConst node, const char **run )
+{
+    *run = ( node->flags & TN_RUN ) ? TT_RUN( node ) : NULL;
+    return TT_RLEN( node );
+}
+
 /*
  *  Create empty tree:
  */
@@ -31,7 +338,31 @@ TTree TT_create( Tree_Flags flags, Tree_Destroy destructor )
     TTree tree = Calloc( sizeof( struct _TernaryTree ), 1 );
 
     if( tree ) {
-        tree->head = _TT_create_node( 0 );
+        /*
+         * Head is not allocated from arena, it outlives TT_clear():
+         */
+        tree->flags = flags & ~T_ARENA;
+        tree->head = _TT_create_node( tree, 0 );
+
+        if( tree->head && ( flags & T_CONCURRENT ) ) {
+            tree->epoch = Calloc( sizeof( struct _TT_Epoch ), 1 );
+
+            if( tree->epoch ) {
+                tree->epoch->size = TT_RETIRE_MAX;
+                tree->epoch->retired = Malloc( TT_RETIRE_MAX *
+                                               sizeof( struct _TT_Retired ) );
+            }
+
+            if( !tree->epoch || !tree->epoch->retired ) {
+                if( tree->epoch ) {
+                    Free( tree->epoch );
+                    tree->epoch = NULL;
+                }
+
+                _TT_free( tree->head );
+                tree->head = NULL;
+            }
+        }
 
         if( tree->head ) {
             tree->flags = flags;
@@ -54,574 +385,4617 @@ TTree TT_create( Tree_Flags flags, Tree_Destroy destructor )
 }
 
 /*
- *  Destroy tree / delete tree node stuff:
+ *  Statistics stuff. Node level is number of bytes compared on the way to
+ *  it (run bytes are compared one by one), and node is counted in histogram
+ *  at level of its last byte. Search path length of key is level of its
+ *  terminal node last byte + 1, tree depth is maximal one. Writers keep all
+ *  of them up to date, see TT_stats().
+ *
+ *  Grow histogram to hold 'level'. Return 0 if memory allocation fails, or 1.
  */
-static void _TT_destroy( TTNode node, TTree tree, int delnode )
+static int _TT_levels( TTree tree, size_t level )
 {
-    if( node->left ) {
-        _TT_destroy( node->left, tree, delnode );
-    }
+    if( level >= tree->levels ) {
+        size_t size = tree->levels ? tree->levels : TT_PATH_SIZE;
+        size_t *histogram;
 
-    if( node->mid ) {
-        _TT_destroy( node->mid, tree, delnode );
-    }
+        while( size <= level ) {
+            size *= 2;
+        }
 
-    if( node->right ) {
-        _TT_destroy( node->right, tree, delnode );
-    }
+        histogram = Realloc( tree->histogram, size * sizeof( size_t ) );
 
-    if( node->data && tree->destructor ) {
-        tree->destructor( node->data );
+        if( !histogram ) {
+            return 0;
+        }
+
+        memset( histogram + tree->levels, 0,
+                ( size - tree->levels ) * sizeof( size_t ) );
+        tree->histogram = histogram;
+        tree->levels = size;
     }
 
-    Free( node->key );
-    tree->keys--;
-    tree->nodes--;
-    memset( node, 0, sizeof( struct _TTNode ) );
+    return 1;
+}
+
+/*
+ *  Count node with last byte at 'level' (histogram must hold it), or remove
+ *  it from counters:
+ */
+static void _TT_stat_node( TTree tree, size_t level, int add )
+{
+    if( add ) {
+        tree->histogram[level]++;
+
+        if( tree->depth <= level ) {
+            tree->depth = level + 1;
+        }
+    }
+    else {
+        tree->histogram[level]--;
 
-    if( delnode ) {
-        Free( node );
+        while( tree->depth && !tree->histogram[tree->depth - 1] ) {
+            tree->depth--;
+        }
     }
 }
-void TT_destroy( TTree tree )
+
+/*
+ *  Count (or remove) splitter tree 'node' started at 'level', with all its
+ *  subtrees. _TT_stat_branch() skips 'left' and 'right' links of node.
+ */
+static void _TT_stat_tree( TTree tree, TTNodeConst node, size_t level,
+                           int add );
+static void _TT_stat_branch( TTree tree, TTNodeConst node, size_t level,
+                             int add )
 {
-    if( tree->head ) {
-        __lock( tree->lock );
-        _TT_destroy( tree->head, tree, 1 );
-        __unlock( tree->lock );
+    level += TT_RLEN( node );
+    _TT_stat_node( tree, level, add );
+
+    if( node->flags & TN_KEY ) {
+        if( add ) {
+            tree->paths += level + 1;
+        }
+        else {
+            tree->paths -= level + 1;
+        }
     }
 
-    memset( tree, 0, sizeof( struct _TernaryTree ) );
-    Free( tree );
+    _TT_stat_tree( tree, node->mid, level + 1, add );
 }
-void TT_clear( const TTree tree )
+static void _TT_stat_tree( TTree tree, TTNodeConst node, size_t level,
+                           int add )
 {
-    __lock( tree->lock );
-    _TT_destroy( tree->head->mid, tree, 1 );
-    tree->head->mid = NULL;
-    __unlock( tree->lock );
+    while( node ) {
+        _TT_stat_branch( tree, node, level, add );
+        _TT_stat_tree( tree, node->left, ++level, add );
+        node = node->right;
+    }
 }
 
 /*
- *  Search nodes stuff:
+ *  Internal, get depth of subtree (levels are counted as above):
  */
-static TTNode _TT_search( TTNode node, const char *s, Tree_Flags flags )
+static size_t _TT_depth( TTNodeConst node, size_t level )
 {
-    TTNode ptr = node;
-
-    if( !ptr || !s || !*s ) {
-        return NULL;
-    }
+    size_t max = 0, rc;
 
-    while( *s && ( ptr && ( ptr->splitter || ptr->key ) ) ) {
-        char c = ( flags & T_NOCASE ) ? tolower( *s ) : *s;
+    while( node ) {
+        size_t end = level + TT_RLEN( node ) + 1;
 
-        if( c < ptr->splitter ) {
-            ptr = ptr->left;
+        if( max < end ) {
+            max = end;
         }
-        else if( c > ptr->splitter ) {
-            ptr = ptr->right;
+
+        rc = _TT_depth( node->mid, end );
+
+        if( rc > max ) {
+            max = rc;
         }
-        else {
-            s++;
 
-            if( *s ) {
-                ptr = ptr->mid;
-            }
+        rc = _TT_depth( node->left, ++level );
+
+        if( rc > max ) {
+            max = rc;
         }
+
+        node = node->right;
     }
 
-    return ( ptr && ptr->key ) ? ptr : NULL;
+    return max;
 }
 
-
-int TT_del_node( const TTree tree, const char *key )
+/*
+ *  Count all nodes again (after splitter trees are rebuilt). Return 0 if
+ *  memory allocation fails (counters are not changed then), or 1.
+ */
+static int _TT_restat( TTree tree )
 {
-    TTNode node;
+    TTNodeConst root = tree->head->mid;
+    size_t depth = _TT_depth( root, 0 );
 
-    if( !tree || !tree->head || !key || !*key ) {
+    if( depth && !_TT_levels( tree, depth - 1 ) ) {
         return 0;
     }
 
-    node = _TT_search( tree->head->mid, key, tree->flags );
+    if( tree->histogram ) {
+        memset( tree->histogram, 0, tree->levels * sizeof( size_t ) );
+    }
+
+    tree->depth = 0;
+    tree->paths = 0;
+    _TT_stat_tree( tree, root, 0, 1 );
+    return 1;
+}
+
+/*
+ *  Destroy tree / delete tree node stuff:
+ */
+static void _TT_destroy( TTNode node, TTree tree )
+{
+    unsigned char flags = node->flags & ( TN_WEIGHT | TN_COUNT | TN_ARENA );
+
+    if( node->left ) {
+        _TT_destroy( node->left, tree );
+    }
+
+    if( node->mid ) {
+        _TT_destroy( node->mid, tree );
+    }
+
+    if( node->right ) {
+        _TT_destroy( node->right, tree );
+    }
+
+    if( node->data && tree->destructor ) {
+        tree->destructor( node->data );
+    }
+
+    memset( node, 0, sizeof( struct _TTNode ) );
+    node->flags = flags;
+    _TT_free( node );
+}
+
+/*
+ *  Internal, remove unlinked subtree from key and node counters (its memory
+ *  may be freed later):
+ */
+static void _TT_uncount( TTree tree, TTNodeConst node )
+{
+    while( node ) {
+        _TT_uncount( tree, node->left );
+        _TT_uncount( tree, node->mid );
+
+        if( node->flags & TN_KEY ) {
+            tree->keys--;
+        }
+
+        tree->nodes--;
+        node = node->right;
+    }
+}
 
+/*
+ *  Internal, free nodes of subtree without data:
+ */
+static void _TT_free_nodes( TTNode node )
+{
     if( node ) {
-        __lock( tree->lock );
-        _TT_destroy( node, tree, 0 );
-        __unlock( tree->lock );
-        return 1;
+        _TT_free_nodes( node->left );
+        _TT_free_nodes( node->mid );
+        _TT_free_nodes( node->right );
+        _TT_free( node );
     }
+}
 
-    return 0;
+/*
+ *  Internal, free retired memory:
+ */
+static void _TT_release( TTree tree, void *ptr, int type )
+{
+    if( type == TT_RETIRE_NODE ) {
+        _TT_free( ptr );
+    }
+    else if( type == TT_RETIRE_TREE ) {
+        _TT_destroy( ptr, tree );
+    }
+    else if( type == TT_RETIRE_BRANCH ) {
+        _TT_free_nodes( ( ( TTNode ) ptr )->mid );
+        _TT_free( ptr );
+    }
+    else if( type == TT_RETIRE_ARENA ) {
+        while( ptr ) {
+            struct _TT_Chunk *next = ( ( struct _TT_Chunk * ) ptr )->next;
+            Free( ptr );
+            ptr = next;
+        }
+    }
+    else if( tree->destructor ) {
+        tree->destructor( ptr );
+    }
 }
-int TT_del_key( const TTree tree, const char *key )
+
+/*
+ *  Internal, check if all readers of given parity are gone, and wait for
+ *  it:
+ */
+static int _TT_quiet( struct _TT_Epoch *epoch, int parity )
 {
-    TTNode node;
+    size_t i;
 
-    if( !tree || !tree->head || !key || !*key ) {
-        return 0;
+    for( i = 0; i < TT_STRIPES; i++ ) {
+        if( __atomic_load_n( &epoch->stripes[i].readers[parity],
+                             __ATOMIC_ACQUIRE ) ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+static void _TT_wait( struct _TT_Epoch *epoch, int parity )
+{
+    while( !_TT_quiet( epoch, parity ) ) {
+        sched_yield();
+    }
+}
+
+/*
+ *  Internal, free first 'n' retired pointers:
+ */
+static void _TT_release_first( TTree tree, size_t n )
+{
+    struct _TT_Epoch *epoch = tree->epoch;
+    size_t i;
+
+    for( i = 0; i < n; i++ ) {
+        _TT_release( tree, epoch->retired[i].ptr, epoch->retired[i].type );
     }
 
-    node = _TT_search( tree->head->mid, key, tree->flags );
+    epoch->count -= n;
+    memmove( epoch->retired, epoch->retired + n,
+             epoch->count * sizeof( struct _TT_Retired ) );
+}
+
+/*
+ *  Internal, start grace period for retired memory, if there is enough of
+ *  it (or 'force' is set) and no other one is running, and free memory of
+ *  finished grace period. Never waits for readers.
+ */
+static void _TT_advance( TTree tree, int force )
+{
+    struct _TT_Epoch *epoch = tree->epoch;
+
+    if( !epoch->pending && epoch->count &&
+            ( force || epoch->count >= TT_RETIRE_MAX ) ) {
+        epoch->parity = ( int )( __atomic_fetch_add( &epoch->epoch, 1,
+                                 __ATOMIC_SEQ_CST ) & 1 );
+        epoch->pending = epoch->count;
+    }
+
+    if( epoch->pending && _TT_quiet( epoch, epoch->parity ) ) {
+        _TT_release_first( tree, epoch->pending );
+        epoch->pending = 0;
+    }
+}
+
+/*
+ *  Internal, wait until all retired memory may be freed, and free it. Must
+ *  not be called inside read section.
+ */
+static void _TT_reclaim( TTree tree )
+{
+    struct _TT_Epoch *epoch = tree->epoch;
+
+    if( epoch && epoch->count ) {
+        if( epoch->pending ) {
+            _TT_wait( epoch, epoch->parity );
+        }
+
+        _TT_wait( epoch, ( int )( __atomic_fetch_add( &epoch->epoch, 1,
+                                  __ATOMIC_SEQ_CST ) & 1 ) );
+        _TT_release_first( tree, epoch->count );
+        epoch->pending = 0;
+    }
+}
+
+/*
+ *  Internal, free memory unlinked from tree: at once, or after grace period
+ *  in T_CONCURRENT tree. Retired list grows, so writer does not wait for
+ *  readers (unless memory allocation fails).
+ */
+static void _TT_retire( TTree tree, void *ptr, int type )
+{
+    struct _TT_Epoch *epoch = tree->epoch;
+
+    if( !ptr || ( type == TT_RETIRE_DATA && !tree->destructor ) ) {
+        return;
+    }
+
+    if( !epoch ) {
+        _TT_release( tree, ptr, type );
+        return;
+    }
+
+    if( epoch->count == epoch->size ) {
+        struct _TT_Retired *retired = Realloc( epoch->retired,
+                                               epoch->size * 2 *
+                                               sizeof( struct _TT_Retired ) );
+
+        if( retired ) {
+            epoch->retired = retired;
+            epoch->size *= 2;
+        }
+        else {
+            _TT_reclaim( tree );
+        }
+    }
+
+    epoch->retired[epoch->count].ptr = ptr;
+    epoch->retired[epoch->count].type = type;
+    epoch->count++;
+    _TT_advance( tree, 0 );
+}
+
+/*
+ *  Internal, enter and leave read section. Stripe is picked by stack
+ *  address, so different threads mostly use different counters.
+ */
+static int _TT_read_begin( struct _TT_Epoch *epoch )
+{
+    unsigned long long addr = ( size_t ) &epoch >> 16;
+    size_t stripe = ( size_t )( ( addr * 0x9E3779B97F4A7C15ULL ) >> 32 ) %
+                    TT_STRIPES;
+
+    for( ;; ) {
+        int parity = __atomic_load_n( &epoch->epoch, __ATOMIC_SEQ_CST ) & 1;
+        __atomic_fetch_add( &epoch->stripes[stripe].readers[parity], 1,
+                            __ATOMIC_SEQ_CST );
+
+        if( ( int )( __atomic_load_n( &epoch->epoch, __ATOMIC_SEQ_CST ) & 1 ) ==
+                parity ) {
+            return ( int )( stripe * 2 ) + parity;
+        }
+
+        __atomic_fetch_sub( &epoch->stripes[stripe].readers[parity], 1,
+                            __ATOMIC_RELEASE );
+    }
+}
+static void _TT_read_end( struct _TT_Epoch *epoch, int token )
+{
+    __atomic_fetch_sub( &epoch->stripes[token / 2].readers[token & 1], 1,
+                        __ATOMIC_RELEASE );
+}
+
+int TT_read_begin( const TTree tree )
+{
+    return ( tree && tree->epoch ) ? _TT_read_begin( tree->epoch ) : 0;
+}
+void TT_read_end( const TTree tree, int token )
+{
+    if( tree && tree->epoch ) {
+        _TT_read_end( tree->epoch, token );
+    }
+}
+
+void TT_destroy( TTree tree )
+{
+    if( tree->head ) {
+        __lock( tree->lock );
+        _TT_reclaim( tree );
+        _TT_destroy( tree->head, tree );
+        _TT_arena_free( tree );
+        __unlock( tree->lock );
+    }
+
+    if( tree->epoch ) {
+        Free( tree->epoch->retired );
+    }
+
+    Free( tree->epoch );
+    Free( tree->histogram );
+    memset( tree, 0, sizeof( struct _TernaryTree ) );
+    Free( tree );
+}
+void TT_clear( const TTree tree )
+{
+    TTNode root;
+    __lock( tree->lock );
+    root = tree->head->mid;
+    tree->changes++;
+    TT_STORE( tree->head->mid, NULL );
+    _TT_retire( tree, root, TT_RETIRE_TREE );
+    _TT_retire( tree, tree->arena, TT_RETIRE_ARENA );
+    tree->arena = NULL;
+    tree->keys = 0;
+    tree->nodes = 0;
+    _TT_restat( tree );
+    __unlock( tree->lock );
+}
+
+/*
+ *  Fold key of T_NOCASE tree once, before walking. Return key itself, 'buf'
+ *  (TT_FOLD_SIZE bytes) if folded key fits, or allocated copy. Result must
+ *  be released with _TT_unfold(). Return NULL if memory allocation fails.
+ *  _TT_fold_n() folds 'len' bytes of binary key.
+ */
+const char *_TT_fold_n( Tree_Flags flags, const char *key, size_t len,
+                        char *buf )
+{
+    char *rc = buf;
+
+    if( !( flags & T_NOCASE ) || !key ) {
+        return key;
+    }
+
+    if( len >= TT_FOLD_SIZE ) {
+        rc = Malloc( len + 1 );
+
+        if( !rc ) {
+            return NULL;
+        }
+    }
+
+    T_Fold( rc, key, len );
+    rc[len] = 0;
+    return rc;
+}
+const char *_TT_fold( Tree_Flags flags, const char *key, char *buf )
+{
+    if( !( flags & T_NOCASE ) || !key ) {
+        return key;
+    }
+
+    return _TT_fold_n( flags, key, strlen( key ), buf );
+}
+void _TT_unfold( const char *key, const char *folded, const char *buf )
+{
+    if( folded != key && folded != buf ) {
+        Free( ( void * ) folded );
+    }
+}
+
+/*
+ *  Search nodes stuff. Follow (folded) key from splitter tree 'node'. Return
+ *  node where last key byte is matched and set *off to number of matched
+ *  bytes of node run, or NULL if key is not found.
+ */
+static TTNode _TT_follow( TTNode node, const char *key, size_t klen,
+                          size_t *off )
+{
+    const unsigned char *s = ( const unsigned char * ) key, *end = s + klen;
+
+    if( !s || !klen ) {
+        return NULL;
+    }
+
+    while( node ) {
+        if( *s < node->splitter ) {
+            node = TT_LOAD( node->left );
+        }
+        else if( *s > node->splitter ) {
+            node = TT_LOAD( node->right );
+        }
+        else {
+            size_t i = 0, len = TT_RLEN( node );
+            s++;
+
+            while( i < len && s < end &&
+                    *s == ( unsigned char ) TT_RUN( node )[i] ) {
+                i++;
+                s++;
+            }
+
+            if( s == end ) {
+                *off = i;
+                return node;
+            }
+
+            if( i < len ) {
+                return NULL;
+            }
+
+            node = TT_LOAD( node->mid );
+        }
+    }
+
+    return NULL;
+}
+
+TTNode __TT_lookup( TTNode node, const char *s, size_t len, Tree_Flags flags,
+                    size_t *off )
+{
+    char buf[TT_FOLD_SIZE];
+    const char *key = _TT_fold_n( flags, s, len, buf );
+    node = key ? _TT_follow( node, key, len, off ) : NULL;
+    _TT_unfold( s, key, buf );
+    return node;
+}
+
+static TTNode _TT_search( TTNode node, const char *s, size_t len,
+                          Tree_Flags flags )
+{
+    size_t off;
+    node = __TT_lookup( node, s, len, flags, &off );
+    return ( node && off == TT_RLEN( node ) &&
+             ( TT_LOAD( node->flags ) & TN_KEY ) ) ? node : NULL;
+}
+
+/*
+ *  Internal, collect links to nodes on existing key path, from the root.
+ *  Return 'path' (TT_PATH_SIZE links) or allocated array for longer paths,
+ *  NULL if memory allocation fails.
+ */
+static TTNode **_TT_path( TTree tree, const char *key, size_t len,
+                          TTNode **path, size_t *depth )
+{
+    TTNode **stack = path, *link = &tree->head->mid, ptr;
+    size_t size = TT_PATH_SIZE;
+    char buf[TT_FOLD_SIZE];
+    const char *folded = _TT_fold_n( tree->flags, key, len, buf );
+    const unsigned char *s = ( const unsigned char * ) folded, *end = s + len;
+
+    *depth = 0;
+
+    if( !s ) {
+        return NULL;
+    }
+
+    while( ( ptr = *link ) != NULL && s < end ) {
+        if( *depth == size ) {
+            size_t bytes = size * 2 * sizeof( TTNode * );
+            TTNode **tmp = ( stack == path ) ? Malloc( bytes ) :
+                           Realloc( stack, bytes );
+
+            if( !tmp ) {
+                if( stack != path ) {
+                    Free( stack );
+                }
+
+                _TT_unfold( key, folded, buf );
+                return NULL;
+            }
+
+            if( stack == path ) {
+                memcpy( tmp, path, size * sizeof( TTNode * ) );
+            }
+
+            stack = tmp;
+            size *= 2;
+        }
+
+        stack[( *depth )++] = link;
+
+        if( *s < ptr->splitter ) {
+            link = &ptr->left;
+        }
+        else if( *s > ptr->splitter ) {
+            link = &ptr->right;
+        }
+        else {
+            size_t i = 0, rlen = TT_RLEN( ptr );
+            s++;
+
+            while( i < rlen && s < end &&
+                    *s == ( unsigned char ) TT_RUN( ptr )[i] ) {
+                i++;
+                s++;
+            }
+
+            if( i < rlen ) {
+                break;
+            }
+
+            link = &ptr->mid;
+        }
+    }
+
+    _TT_unfold( key, folded, buf );
+    return stack;
+}
+
+/*
+ *  Weights stuff. Recompute maximum of node from its key and links:
+ */
+static void _TT_remax( TTNode node )
+{
+    size_t max = ( node->flags & TN_KEY ) ? TT_WEIGHT( node )->weight : 0;
+
+    if( max < TT_MAX( node->left ) ) {
+        max = TT_MAX( node->left );
+    }
+
+    if( max < TT_MAX( node->mid ) ) {
+        max = TT_MAX( node->mid );
+    }
+
+    if( max < TT_MAX( node->right ) ) {
+        max = TT_MAX( node->right );
+    }
+
+    TT_WEIGHT( node )->max = max;
+}
+
+/*
+ *  Set weight of 'node' (may be NULL) and recompute maximums on existing
+ *  key path, bottom-up. Return 0 if memory allocation fails (nothing is
+ *  changed then), or 1.
+ */
+static int _TT_reweigh( TTree tree, const char *key, size_t len, TTNode node,
+                        size_t weight )
+{
+    TTNode *path[TT_PATH_SIZE], **links;
+    size_t depth;
+
+    links = _TT_path( tree, key, len, path, &depth );
+
+    if( !links ) {
+        return 0;
+    }
+
+    tree->changes++;
+
+    if( node ) {
+        TT_WEIGHT( node )->weight = weight;
+    }
+
+    while( depth-- ) {
+        _TT_remax( *links[depth] );
+    }
+
+    if( links != path ) {
+        Free( links );
+    }
+
+    return 1;
+}
+
+size_t TT_weight( TTNodeConst node )
+{
+    return ( node && ( node->flags & TN_WEIGHT ) ) ?
+           TT_WEIGHT( node )->weight : 0;
+}
+
+/*
+ *  Counters stuff. Recount keys of node from its key and links:
+ */
+static void _TT_recount( TTNode node, Tree_Flags flags )
+{
+    size_t count = ( node->flags & TN_KEY ) ? 1 : 0;
+    count += TT_KEYS( node->left, flags ) + TT_KEYS( node->mid, flags ) +
+             TT_KEYS( node->right, flags );
+    __atomic_store_n( TT_COUNTER( node, flags ), count, __ATOMIC_RELAXED );
+}
+
+/*
+ *  Add 'n' to (or subtract it from) counters on existing folded key path,
+ *  top-down:
+ */
+static void _TT_count_path( TTree tree, const char *key, size_t len,
+                            size_t n, int add )
+{
+    const unsigned char *s = ( const unsigned char * ) key, *end = s + len;
+    TTNode node = tree->head->mid;
+
+    while( node && s < end ) {
+        size_t *counter = TT_COUNTER( node, tree->flags );
+
+        if( add ) {
+            __atomic_fetch_add( counter, n, __ATOMIC_RELAXED );
+        }
+        else {
+            __atomic_fetch_sub( counter, n, __ATOMIC_RELAXED );
+        }
+
+        if( *s < node->splitter ) {
+            node = node->left;
+        }
+        else if( *s > node->splitter ) {
+            node = node->right;
+        }
+        else {
+            s += 1 + TT_RLEN( node );
+            node = node->mid;
+        }
+    }
+}
+
+/*
+ *  Internal, recompute maximum and counter of node (if tree has them):
+ */
+static void _TT_refresh( TTNode node, Tree_Flags flags )
+{
+    if( flags & T_WEIGHTS ) {
+        _TT_remax( node );
+    }
+
+    if( flags & T_COUNTS ) {
+        _TT_recount( node, flags );
+    }
+}
+
+/*
+ *  Delete stuff. Recompute maximums and counters of right spine, bottom-up:
+ */
+static void _TT_respine( TTNode node, Tree_Flags flags )
+{
+    if( node ) {
+        _TT_respine( node->right, flags );
+        _TT_refresh( node, flags );
+    }
+}
+
+/*
+ *  Internal, remove nodes left without key and 'mid' link on key path,
+ *  bottom-up. Node with both siblings is replaced by its predecessor, but
+ *  not in T_CONCURRENT tree (readers may be inside moved node), such nodes
+ *  are left for TT_compact(). Key is already deleted, and 'mid' is its
+ *  unlinked subtree (or NULL), they are removed from statistics here.
+ */
+static void _TT_prune( TTree tree, const char *key, size_t len,
+                       TTNodeConst mid )
+{
+    TTNode *path[TT_PATH_SIZE], **links;
+    size_t depth, level = 0, i;
+
+    links = _TT_path( tree, key, len, path, &depth );
+
+    if( !links ) {
+        _TT_restat( tree );
+        return;
+    }
+
+    for( i = 1; i < depth; i++ ) {
+        TTNode parent = *links[i - 1];
+        level += ( links[i] == &parent->mid ) ? TT_RLEN( parent ) + 1 : 1;
+    }
+
+    if( depth ) {
+        size_t end = level + TT_RLEN( *links[depth - 1] );
+        tree->paths -= end + 1;
+        _TT_stat_tree( tree, mid, end + 1, 0 );
+    }
+
+    while( depth-- ) {
+        TTNode node = *links[depth];
+
+        if( ( node->flags & TN_KEY ) || node->mid ) {
+            break;
+        }
+
+        if( !node->left && !node->right ) {
+            _TT_stat_node( tree, level + TT_RLEN( node ), 0 );
+            TT_STORE( *links[depth], NULL );
+        }
+        else if( !node->left || !node->right ) {
+            /*
+             * Sibling subtree moves one level up:
+             */
+            TTNode child = node->left ? node->left : node->right;
+            _TT_stat_tree( tree, node, level, 0 );
+            TT_STORE( *links[depth], child );
+            _TT_stat_tree( tree, child, level, 1 );
+        }
+        else if( tree->epoch ) {
+            break;
+        }
+        else {
+            TTNode *link = &node->left, pred;
+            _TT_stat_tree( tree, node, level, 0 );
+
+            while( ( pred = *link )->right ) {
+                link = &pred->right;
+            }
+
+            *link = pred->left;
+            pred->left = node->left;
+            pred->right = node->right;
+            *links[depth] = pred;
+            _TT_stat_tree( tree, pred, level, 1 );
+
+            if( tree->flags & ( T_WEIGHTS | T_COUNTS ) ) {
+                _TT_respine( pred->left, tree->flags );
+                _TT_refresh( pred, tree->flags );
+            }
+        }
+
+        _TT_retire( tree, node, TT_RETIRE_NODE );
+        tree->nodes--;
+
+        if( depth ) {
+            TTNode parent = *links[depth - 1];
+            level -= ( links[depth] == &parent->mid ) ? TT_RLEN( parent ) + 1 :
+                     1;
+        }
+    }
+
+    if( links != path ) {
+        Free( links );
+    }
+}
+
+/*
+ *  Internal, delete key (and all longer keys started by it, if 'subtree'
+ *  is set), then prune empty nodes:
+ */
+static int _TT_del( TTree tree, const char *key, size_t len, int subtree )
+{
+    TTNode node;
+    char buf[TT_FOLD_SIZE];
+    const char *folded;
+
+    if( !tree || !tree->head || !key || !len ) {
+        return 0;
+    }
+
+    __lock( tree->lock );
+    folded = _TT_fold_n( tree->flags, key, len, buf );
+    node = folded ? _TT_search( tree->head->mid, folded, len,
+                                tree->flags & ~T_NOCASE ) : NULL;
+
+    if( node ) {
+        TTNode mid = subtree ? node->mid : NULL;
+
+        tree->changes++;
+
+        if( tree->flags & T_COUNTS ) {
+            _TT_count_path( tree, folded, len,
+                            1 + TT_KEYS( mid, tree->flags ), 0 );
+        }
+
+        TT_STORE( node->flags, node->flags & ~TN_KEY );
+        _TT_retire( tree, node->data, TT_RETIRE_DATA );
+        TT_STORE( node->data, NULL );
+        tree->keys--;
+
+        if( mid ) {
+            TT_STORE( node->mid, NULL );
+        }
+
+        if( tree->flags & T_WEIGHTS ) {
+            TT_WEIGHT( node )->weight = 0;
+        }
+
+        _TT_prune( tree, key, len, mid );
+
+        if( tree->flags & T_WEIGHTS ) {
+            _TT_reweigh( tree, key, len, NULL, 0 );
+        }
+
+        if( mid ) {
+            _TT_uncount( tree, mid );
+            _TT_retire( tree, mid, TT_RETIRE_TREE );
+        }
+    }
+
+    _TT_unfold( key, folded, buf );
+    __unlock( tree->lock );
+    return node ? 1 : 0;
+}
+
+int TT_del_node( const TTree tree, const char *key )
+{
+    return _TT_del( tree, key, key ? strlen( key ) : 0, 1 );
+}
+int TT_del_key( const TTree tree, const char *key )
+{
+    return _TT_del( tree, key, key ? strlen( key ) : 0, 0 );
+}
+int TT_del_key_n( const TTree tree, const void *key, size_t len )
+{
+    return _TT_del( tree, key, len, 0 );
+}
+
+TTNodeConst TT_search_n( const TTree tree, const void *key, size_t len )
+{
+    TTNode node;
+
+    if( !tree || !tree->head || !key || !len ) {
+        return NULL;
+    }
+
+    if( tree->epoch ) {
+        int token = _TT_read_begin( tree->epoch );
+        node = _TT_search( TT_LOAD( tree->head->mid ), key, len, tree->flags );
+        _TT_read_end( tree->epoch, token );
+        return node;
+    }
+
+    __lock( tree->lock );
+    node = _TT_search( tree->head->mid, key, len, tree->flags );
+    __unlock( tree->lock );
+    return node;
+}
+TTNodeConst TT_search( const TTree tree, const char *s )
+{
+    return TT_search_n( tree, s, s ? strlen( s ) : 0 );
+}
+
+/*
+ *  Longest prefix match: single descent, remember last terminal node passed
+ *  on the way.
+ */
+static TTNode _TT_longest( TTNode node, const char *key, size_t klen,
+                           size_t *len )
+{
+    const unsigned char *s = ( const unsigned char * ) key, *end = s + klen;
+    TTNode rc = NULL;
+
+    while( node && s < end ) {
+        if( *s < node->splitter ) {
+            node = TT_LOAD( node->left );
+        }
+        else if( *s > node->splitter ) {
+            node = TT_LOAD( node->right );
+        }
+        else {
+            size_t i = 0, rlen = TT_RLEN( node );
+            s++;
+
+            while( i < rlen && s < end &&
+                    *s == ( unsigned char ) TT_RUN( node )[i] ) {
+                i++;
+                s++;
+            }
+
+            if( i < rlen ) {
+                break;
+            }
+
+            if( TT_LOAD( node->flags ) & TN_KEY ) {
+                rc = node;
+                *len = s - ( const unsigned char * ) key;
+            }
+
+            node = TT_LOAD( node->mid );
+        }
+    }
+
+    return rc;
+}
+
+TTNodeConst TT_longest_prefix( const TTree tree, const char *input,
+                               size_t *len )
+{
+    TTNode node = NULL;
+    size_t matched = 0, ilen;
+    char buf[TT_FOLD_SIZE];
+    const char *folded;
+
+    if( tree && tree->head && input && *input ) {
+        int token = 0;
+        ilen = strlen( input );
+
+        if( tree->epoch ) {
+            token = _TT_read_begin( tree->epoch );
+        }
+        else {
+            __lock( tree->lock );
+        }
+
+        folded = _TT_fold_n( tree->flags, input, ilen, buf );
+
+        if( folded ) {
+            node = _TT_longest( TT_LOAD( tree->head->mid ), folded, ilen,
+                                &matched );
+            _TT_unfold( input, folded, buf );
+        }
+
+        if( tree->epoch ) {
+            _TT_read_end( tree->epoch, token );
+        }
+        else {
+            __unlock( tree->lock );
+        }
+    }
+
+    if( len ) {
+        *len = matched;
+    }
+
+    return node;
+}
+
+/*
+ *  Internal, split node run after 'pos' bytes. Node keeps run head and
+ *  becomes non-terminal, new 'mid' node gets run tail, key and data.
+ */
+static TTNode _TT_split_run( TTree tree, TTNode *link, size_t pos )
+{
+    TTNode node = *link, head = node;
+    TTRunNode rnode = ( TTRunNode ) node;
+    int ref = _TT_static( node );
+    TTNode tail = _TT_create_run( tree, rnode->run[pos], rnode->run + pos + 1,
+                                  rnode->len - pos - 1, ref );
+
+    if( !tail ) {
+        return NULL;
+    }
+
+    if( tree->flags & T_CONCURRENT ) {
+        /*
+         * Readers may be inside the node, so split its copy:
+         */
+        head = _TT_create_run( tree, node->splitter, rnode->run, pos, ref );
+
+        if( !head ) {
+            _TT_free( tail );
+            return NULL;
+        }
+
+        head->left = node->left;
+        head->right = node->right;
+    }
+
+    if( tree->flags & T_WEIGHTS ) {
+        TT_WEIGHT( tail )->weight = TT_WEIGHT( node )->weight;
+        TT_WEIGHT( tail )->max = TT_MAX( node->mid );
+
+        if( TT_WEIGHT( tail )->max < TT_WEIGHT( tail )->weight ) {
+            TT_WEIGHT( tail )->max = TT_WEIGHT( tail )->weight;
+        }
+
+        TT_WEIGHT( head )->max = TT_WEIGHT( node )->max;
+        TT_WEIGHT( head )->weight = 0;
+    }
+
+    tail->flags |= node->flags & TN_KEY;
+    tail->data = node->data;
+    tail->mid = node->mid;
+    tree->nodes++;
+
+    if( tree->flags & T_COUNTS ) {
+        _TT_recount( tail, tree->flags );
+    }
+
+    if( head != node ) {
+        if( tree->flags & T_COUNTS ) {
+            *TT_COUNTER( head, tree->flags ) = TT_KEYS( node, tree->flags );
+        }
+
+        head->mid = tail;
+        TT_STORE( *link, head );
+        _TT_retire( tree, node, TT_RETIRE_NODE );
+        return head;
+    }
+
+    node->flags &= ~TN_KEY;
+    node->data = NULL;
+    node->mid = tail;
+    rnode->len = pos;
+    return node;
+}
+
+/*
+ *  Insert nodes stuff. Walk key once, create missing nodes at the tail and
+ *  return terminal node. In compressed tree the tail is single run node,
+ *  which references key memory if 'ref' is set (and key is not folded).
+ */
+static TTNode __TT_insert( TTree tree, const char *key, size_t klen,
+                           void *data, int ref )
+{
+    TTNode node, *link = &tree->head->mid, chain = NULL, *tail = &chain, next;
+    char buf[TT_FOLD_SIZE];
+    const char *folded = _TT_fold_n( tree->flags, key, klen, buf );
+    const unsigned char *s = ( const unsigned char * ) folded, *end = s + klen;
+    size_t level = 0;
+    int added = 0;
+
+    if( !s ) {
+        return NULL;
+    }
+
+    tree->changes++;
+
+    while( ( node = *link ) != NULL ) {
+        if( *s < node->splitter ) {
+            link = &node->left;
+            level++;
+        }
+        else if( *s > node->splitter ) {
+            link = &node->right;
+            level++;
+        }
+        else {
+            size_t i = 0, len = TT_RLEN( node );
+            s++;
+
+            while( i < len && s < end &&
+                    *s == ( unsigned char ) TT_RUN( node )[i] ) {
+                i++;
+                s++;
+            }
+
+            if( i < len ) {
+                if( !( node = _TT_split_run( tree, link, i ) ) ) {
+                    s = NULL;
+                    break;
+                }
+
+                _TT_stat_node( tree, level + i, 1 );
+            }
+
+            level += TT_RLEN( node );
+
+            if( s == end ) {
+                break;
+            }
+
+            link = &node->mid;
+            level++;
+        }
+    }
+
+    if( !node && s && !_TT_levels( tree, level + ( end - s ) ) ) {
+        s = NULL;
+    }
+
+    while( !node && s ) {
+        if( tree->flags & T_COMPRESS ) {
+            size_t len = end - s - 1;
+            node = _TT_create_run( tree, *s, ( const char * ) s + 1, len,
+                                   ref && folded == key );
+            s += len;
+        }
+        else {
+            node = _TT_create_node( tree, *s );
+        }
+
+        if( !node ) {
+            while( chain ) {
+                node = chain->mid;
+                _TT_free( chain );
+                tree->nodes--;
+                chain = node;
+            }
+
+            s = NULL;
+            break;
+        }
+
+        *tail = node;
+        tree->nodes++;
+
+        if( ++s < end ) {
+            tail = &node->mid;
+            node = NULL;
+        }
+    }
+
+    if( !node ) {
+        _TT_unfold( key, folded, buf );
+        return NULL;
+    }
+
+    /*
+     * Count new nodes, 'level' becomes level of terminal node last byte:
+     */
+    for( next = chain; next; next = next->mid ) {
+        level += TT_RLEN( next );
+        _TT_stat_node( tree, level, 1 );
+
+        if( next != node ) {
+            level++;
+        }
+    }
+
+    /*
+     * New nodes are built aside and published with single store:
+     */
+    if( !( node->flags & TN_KEY ) ) {
+        TT_STORE( node->data, data );
+        TT_STORE( node->flags, node->flags | TN_KEY );
+        tree->keys++;
+        tree->paths += level + 1;
+        added = 1;
+    }
+    else if( tree->flags & T_INSERT_REPLACE ) {
+        _TT_retire( tree, node->data, TT_RETIRE_DATA );
+        TT_STORE( node->data, data );
+    }
+
+    if( chain ) {
+        TT_STORE( *link, chain );
+    }
+
+    if( added && ( tree->flags & T_COUNTS ) ) {
+        _TT_count_path( tree, folded, klen, 1, 1 );
+    }
+
+    _TT_unfold( key, folded, buf );
+
+    /*
+     * else do not free data
+     */
+    return node;
+}
+static TTNode _TT_insert( TTree tree, const char *key, size_t klen,
+                          void *data )
+{
+    return __TT_insert( tree, key, klen, data,
+                        tree->flags & T_STATIC_KEYS );
+}
+
+TTNodeConst TT_insert_n( const TTree tree, const void *key, size_t len,
+                         void *data )
+{
+    TTNode node;
+
+    if( !tree || !tree->head || !key || !len ) {
+        return NULL;
+    }
+
+    __lock( tree->lock );
+    node = _TT_insert( tree, key, len, data );
+    __unlock( tree->lock );
+    return ( node && ( tree->flags & T_INSERT_FAST ) ) ? tree->head : node;
+}
+TTNodeConst TT_insert( const TTree tree, const char *s, void *data )
+{
+    return TT_insert_n( tree, s, s ? strlen( s ) : 0, data );
+}
+
+TTNodeConst TT_insert_weight( const TTree tree, const char *s, void *data,
+                              size_t weight )
+{
+    TTNode node;
+    size_t len;
+
+    if( !tree || !tree->head || !s || !*s || !( tree->flags & T_WEIGHTS ) ) {
+        return NULL;
+    }
+
+    len = strlen( s );
+    __lock( tree->lock );
+    node = _TT_insert( tree, s, len, data );
+
+    if( node && !_TT_reweigh( tree, s, len, node, weight ) ) {
+        node = NULL;
+    }
+
+    __unlock( tree->lock );
+    return ( node && ( tree->flags & T_INSERT_FAST ) ) ? tree->head : node;
+}
+
+/*
+ *  Balanced build stuff. Medians are inserted first, so splitter trees built
+ *  from sorted keys stay near log height. Key lengths are taken from 'lens'
+ *  (binary keys) or strlen(). Temporary keys are copied ('ref' is 0) even in
+ *  T_STATIC_KEYS tree.
+ */
+static int _TT_build( TTree tree, const char **keys, const size_t *lens,
+                      void **datas, size_t lo, size_t hi, int ref )
+{
+    while( lo < hi ) {
+        size_t mid = lo + ( hi - lo ) / 2;
+        size_t len = lens ? lens[mid] : keys[mid] ? strlen( keys[mid] ) : 0;
+
+        if( keys[mid] && len &&
+                !__TT_insert( tree, keys[mid], len,
+                              datas ? datas[mid] : NULL,
+                              ref && ( tree->flags & T_STATIC_KEYS ) ) ) {
+            return 0;
+        }
+
+        if( !_TT_build( tree, keys, lens, datas, lo, mid, ref ) ) {
+            return 0;
+        }
+
+        lo = mid + 1;
+    }
+
+    return 1;
+}
+int TT_build( const TTree tree, const char **keys, void **datas, size_t n )
+{
+    int rc;
+
+    if( !tree || !tree->head || !keys ) {
+        return 0;
+    }
+
+    __lock( tree->lock );
+    rc = _TT_build( tree, keys, NULL, datas, 0, n, 1 );
+    __unlock( tree->lock );
+    return rc;
+}
+
+/*
+ *  Tree walking stuff:
+ */
+static void _TT_walk( TTNodeConst node, TT_Walk walker, void *data )
+{
+    if( node ) {
+        _TT_walk( node->left, walker, data );
+        _TT_walk( node->mid, walker, data );
+        _TT_walk( node->right, walker, data );
+        walker( node, data );
+    }
+}
+static void _TT_walk_asc( TTNodeConst node, TT_Walk walker, void *data )
+{
+    if( node ) {
+        //        walker( node, data );
+        _TT_walk_asc( node->left, walker, data );
+        walker( node, data );
+        _TT_walk_asc( node->mid, walker, data );
+        _TT_walk_asc( node->right, walker, data );
+    }
+}
+static void _TT_walk_desc( TTNodeConst node, TT_Walk walker, void *data )
+{
+    if( node ) {
+        _TT_walk_desc( node->right, walker, data );
+        _TT_walk_desc( node->mid, walker, data );
+        walker( node, data );
+        _TT_walk_desc( node->left, walker, data );
+        //        walker( node, data );
+    }
+}
+void TT_walk( const TTree tree, TT_Walk walker, void *data )
+{
+    if( tree ) {
+        __lock( tree->lock );
+        _TT_walk( tree->head, walker, data );
+        __unlock( tree->lock );
+    }
+}
+void TT_walk_asc( const TTree tree, TT_Walk walker, void *data )
+{
+    if( tree ) {
+        __lock( tree->lock );
+        _TT_walk_asc( tree->head, walker, data );
+        __unlock( tree->lock );
+    }
+}
+void TT_walk_desc( const TTree tree, TT_Walk walker, void *data )
+{
+    if( tree ) {
+        __lock( tree->lock );
+        _TT_walk_desc( tree->head, walker, data );
+        __unlock( tree->lock );
+    }
+}
+
+/*
+ *  Tree information stuff:
+ */
+size_t TT_depth( const TTree tree )
+{
+    size_t depth = 0;
+
+    if( tree ) {
+        __lock( tree->lock );
+        depth = tree->depth;
+        __unlock( tree->lock );
+    }
+
+    return depth;
+}
+int TT_stats( const TTree tree, TT_Stats *stats )
+{
+    if( !tree || !stats ) {
+        return 0;
+    }
+
+    __lock( tree->lock );
+    stats->keys = tree->keys;
+    stats->nodes = tree->nodes;
+    stats->depth = tree->depth;
+    stats->paths = tree->paths;
+    __unlock( tree->lock );
+    stats->average = stats->keys ? ( double ) stats->paths / stats->keys : 0;
+    return 1;
+}
+size_t TT_histogram( const TTree tree, size_t *levels, size_t size )
+{
+    size_t depth = 0;
+
+    if( tree ) {
+        __lock( tree->lock );
+        depth = tree->depth;
+
+        if( levels && depth ) {
+            memcpy( levels, tree->histogram,
+                    ( size < depth ? size : depth ) * sizeof( size_t ) );
+        }
+
+        __unlock( tree->lock );
+    }
+
+    return depth;
+}
+
+/*
+ *  Rebuild keys from path stuff:
+ */
+struct _TT_Keys {
+    char *key;
+    size_t len;
+    size_t size;
+};
+
+static int _TT_keys_grow( struct _TT_Keys *keys, size_t len )
+{
+    if( keys->size < len + 1 ) {
+        size_t size = keys->size ? keys->size : 64;
+        char *key;
+
+        while( size < len + 1 ) {
+            size *= 2;
+        }
+
+        key = Realloc( keys->key, size );
+
+        if( !key ) {
+            return 0;
+        }
+
+        keys->key = key;
+        keys->size = size;
+    }
+
+    return 1;
+}
+
+static int _TT_keys_init( struct _TT_Keys *keys, const char *prefix,
+                          size_t len, Tree_Flags flags )
+{
+    memset( keys, 0, sizeof( struct _TT_Keys ) );
+
+    if( !_TT_keys_grow( keys, len + 1 ) ) {
+        return 0;
+    }
+
+    if( flags & T_NOCASE ) {
+        T_Fold( keys->key, prefix, len );
+    }
+    else if( len ) {
+        memcpy( keys->key, prefix, len );
+    }
+
+    keys->len = len;
+    keys->key[len] = 0;
+    return 1;
+}
+
+/*
+ *  Append node splitter and run to keys buffer. Return number of appended
+ *  bytes, 0 if memory allocation fails.
+ */
+static size_t _TT_keys_push( struct _TT_Keys *keys, TTNodeConst node )
+{
+    size_t len = TT_RLEN( node );
+
+    if( !_TT_keys_grow( keys, keys->len + len + 1 ) ) {
+        return 0;
+    }
+
+    keys->key[keys->len++] = node->splitter;
+
+    if( len ) {
+        memcpy( keys->key + keys->len, TT_RUN( node ), len );
+        keys->len += len;
+    }
+
+    keys->key[keys->len] = 0;
+    return len + 1;
+}
+
+static void _TT_keys_pop( struct _TT_Keys *keys, size_t len )
+{
+    keys->len -= len;
+    keys->key[keys->len] = 0;
+}
+
+/*
+ *  Walk keys below node in ascending order. Return non-zero if walker
+ *  stopped walking (or memory allocation fails).
+ */
+int _TT_walk_keys( TTNodeConst node, struct _TT_Keys *keys,
+                   TT_KeyWalk walker, void *data )
+{
+    size_t len;
+    int rc;
+
+    if( !node ) {
+        return 0;
+    }
+
+    if( _TT_walk_keys( node->left, keys, walker, data ) ) {
+        return 1;
+    }
+
+    len = _TT_keys_push( keys, node );
+
+    if( !len ) {
+        return 1;
+    }
+
+    rc = ( node->flags & TN_KEY ) ?
+         walker( keys->key, keys->len, node, data ) : 0;
+
+    if( !rc ) {
+        rc = _TT_walk_keys( node->mid, keys, walker, data );
+    }
+
+    _TT_keys_pop( keys, len );
+    return rc ? rc : _TT_walk_keys( node->right, keys, walker, data );
+}
+
+int TT_walk_keys( const TTree tree, TT_KeyWalk walker, void *data )
+{
+    struct _TT_Keys keys;
+    int rc = 1;
+
+    if( tree && _TT_keys_init( &keys, NULL, 0, tree->flags ) ) {
+        __lock( tree->lock );
+        rc = !_TT_walk_keys( tree->head->mid, &keys, walker, data );
+        __unlock( tree->lock );
+        Free( keys.key );
+    }
+
+    return rc;
+}
+
+/*
+ *  Range walking stuff. While key prefix is equal to prefix of bound, the
+ *  bound is 'tight' and limits branches. Once prefix differs from it, the
+ *  whole subtree is inside range on this side.
+ */
+struct _TT_Range {
+    const unsigned char *lo;
+    size_t lolen;
+    const unsigned char *hi;
+    size_t hilen;
+    int desc;
+    struct _TT_Keys keys;
+    TT_KeyWalk walker;
+    void *data;
+};
+
+/*
+ *  Internal, compare first 'len' bytes of node (splitter and run) with
+ *  bound, as memcmp() does:
+ */
+static int _TT_range_cmp( TTNodeConst node, const unsigned char *bound,
+                          size_t len )
+{
+    int rc = ( int ) node->splitter - bound[0];
+
+    if( rc || len == 1 ) {
+        return rc;
+    }
+
+    return memcmp( TT_RUN( node ), bound + 1, len - 1 );
+}
+
+/*
+ *  Walk keys of node within range, 'lo' and 'hi' are set if bounds are
+ *  tight. Return non-zero if walker stopped walking (or memory allocation
+ *  fails).
+ */
+static int _TT_range( struct _TT_Range *range, TTNodeConst node, int lo,
+                      int hi )
+{
+    size_t d = range->keys.len, n, len;
+    int key = 1, mid = 1, mlo = 0, mhi = 0, left, right, rc = 0;
+    TTNodeConst first, last;
+
+    if( !node ) {
+        return 0;
+    }
+
+    n = 1 + TT_RLEN( node );
+
+    if( lo ) {
+        size_t rest = range->lolen - d;
+        int cmp = _TT_range_cmp( node, range->lo + d, rest < n ? rest : n );
+
+        if( cmp < 0 ) {
+            key = mid = 0;
+        }
+        else if( !cmp && rest > n ) {
+            key = 0;
+            mlo = 1;
+        }
+    }
+
+    if( hi ) {
+        size_t rest = range->hilen - d;
+        int cmp = _TT_range_cmp( node, range->hi + d, rest < n ? rest : n );
+
+        if( cmp > 0 || ( !cmp && rest <= n ) ) {
+            key = mid = 0;
+        }
+        else if( !cmp ) {
+            mhi = 1;
+        }
+    }
+
+    left = !lo || node->splitter > range->lo[d];
+    right = !hi || node->splitter < range->hi[d];
+    first = range->desc ? ( right ? node->right : NULL ) :
+            ( left ? node->left : NULL );
+    last = range->desc ? ( left ? node->left : NULL ) :
+           ( right ? node->right : NULL );
+
+    if( _TT_range( range, first, lo, hi ) ) {
+        return 1;
+    }
+
+    if( key || mid ) {
+        key = key && ( node->flags & TN_KEY );
+        len = _TT_keys_push( &range->keys, node );
+
+        if( !len ) {
+            return 1;
+        }
+
+        if( key && !range->desc ) {
+            rc = range->walker( range->keys.key, range->keys.len, node,
+                                range->data );
+        }
+
+        if( !rc && mid ) {
+            rc = _TT_range( range, node->mid, mlo, mhi );
+        }
+
+        if( !rc && key && range->desc ) {
+            rc = range->walker( range->keys.key, range->keys.len, node,
+                                range->data );
+        }
+
+        _TT_keys_pop( &range->keys, len );
+
+        if( rc ) {
+            return rc;
+        }
+    }
+
+    return _TT_range( range, last, lo, hi );
+}
+
+static int _TT_walk_range( TTree tree, const char *lo, const char *hi,
+                           TT_KeyWalk walker, void *data, int desc )
+{
+    struct _TT_Range range;
+    char lbuf[TT_FOLD_SIZE], hbuf[TT_FOLD_SIZE];
+    const char *lfold, *hfold;
+    int rc = 1;
+
+    if( !tree || !tree->head || ( hi && !*hi ) ) {
+        return 1;
+    }
+
+    lfold = _TT_fold( tree->flags, lo, lbuf );
+    hfold = _TT_fold( tree->flags, hi, hbuf );
+
+    if( ( lo && !lfold ) || ( hi && !hfold ) ||
+            !_TT_keys_init( &range.keys, NULL, 0, tree->flags ) ) {
+        rc = 0;
+    }
+    else {
+        range.lo = ( const unsigned char * ) lfold;
+        range.lolen = lo ? strlen( lo ) : 0;
+        range.hi = ( const unsigned char * ) hfold;
+        range.hilen = hi ? strlen( hi ) : 0;
+        range.desc = desc;
+        range.walker = walker;
+        range.data = data;
+        __lock( tree->lock );
+        rc = !_TT_range( &range, tree->head->mid, range.lolen != 0,
+                         hi != NULL );
+        __unlock( tree->lock );
+        Free( range.keys.key );
+    }
+
+    _TT_unfold( lo, lfold, lbuf );
+    _TT_unfold( hi, hfold, hbuf );
+    return rc;
+}
+
+int TT_walk_range( const TTree tree, const char *lo, const char *hi,
+                   TT_KeyWalk walker, void *data )
+{
+    return _TT_walk_range( tree, lo, hi, walker, data, 0 );
+}
+int TT_walk_range_desc( const TTree tree, const char *lo, const char *hi,
+                        TT_KeyWalk walker, void *data )
+{
+    return _TT_walk_range( tree, lo, hi, walker, data, 1 );
+}
+
+/*
+ *  Fuzzy search stuff. Every key byte adds Levenshtein row (distances from
+ *  key to each query prefix) to the rows of its parent, so siblings share
+ *  rows and subtree is pruned as soon as minimum of the row exceeds bound.
+ */
+struct _TT_Fuzzy {
+    const unsigned char *query;
+    size_t qlen;
+    size_t max;
+    size_t *rows;
+    size_t size;
+    struct _TT_Keys keys;
+    TT_KeyWalk walker;
+    void *data;
+};
+
+/*
+ *  Internal, calculate row 'depth' + 1 for key byte 'c'. Return minimal
+ *  distance in the row, or (size_t)-1 if memory allocation fails.
+ */
+static size_t _TT_fuzzy_row( struct _TT_Fuzzy *fuzzy, size_t depth,
+                             unsigned char c )
+{
+    size_t *prev, *row, i, min;
+
+    if( ( depth + 2 ) * ( fuzzy->qlen + 1 ) > fuzzy->size ) {
+        size_t size = fuzzy->size * 2;
+        size_t *rows;
+
+        while( ( depth + 2 ) * ( fuzzy->qlen + 1 ) > size ) {
+            size *= 2;
+        }
+
+        rows = Realloc( fuzzy->rows, size * sizeof( size_t ) );
+
+        if( !rows ) {
+            return ( size_t ) - 1;
+        }
+
+        fuzzy->rows = rows;
+        fuzzy->size = size;
+    }
+
+    prev = fuzzy->rows + depth * ( fuzzy->qlen + 1 );
+    row = prev + fuzzy->qlen + 1;
+    row[0] = min = prev[0] + 1;
+
+    for( i = 1; i <= fuzzy->qlen; i++ ) {
+        size_t d = prev[i - 1] + ( fuzzy->query[i - 1] != c );
+
+        if( d > prev[i] + 1 ) {
+            d = prev[i] + 1;
+        }
+
+        if( d > row[i - 1] + 1 ) {
+            d = row[i - 1] + 1;
+        }
+
+        row[i] = d;
+
+        if( min > d ) {
+            min = d;
+        }
+    }
+
+    return min;
+}
+
+/*
+ *  Internal, return non-zero if walker stopped walking (or memory
+ *  allocation fails).
+ */
+static int _TT_fuzzy( TTNodeConst node, struct _TT_Fuzzy *fuzzy )
+{
+    size_t depth, len, i, min = 0;
+    int rc = 0;
+
+    if( !node ) {
+        return 0;
+    }
+
+    if( _TT_fuzzy( node->left, fuzzy ) ) {
+        return 1;
+    }
+
+    depth = fuzzy->keys.len;
+    len = _TT_keys_push( &fuzzy->keys, node );
+
+    if( !len ) {
+        return 1;
+    }
+
+    for( i = 0; i < len && min <= fuzzy->max; i++ ) {
+        min = _TT_fuzzy_row( fuzzy, depth + i,
+                             ( unsigned char ) fuzzy->keys.key[depth + i] );
+    }
+
+    if( min == ( size_t ) - 1 ) {
+        rc = 1;
+    }
+    else if( min <= fuzzy->max ) {
+        if( ( node->flags & TN_KEY ) &&
+                fuzzy->rows[( depth + len + 1 ) * ( fuzzy->qlen + 1 ) - 1] <=
+                fuzzy->max ) {
+            rc = fuzzy->walker( fuzzy->keys.key, fuzzy->keys.len, node,
+                                fuzzy->data );
+        }
+
+        if( !rc ) {
+            rc = _TT_fuzzy( node->mid, fuzzy );
+        }
+    }
+
+    _TT_keys_pop( &fuzzy->keys, len );
+    return rc ? rc : _TT_fuzzy( node->right, fuzzy );
+}
+
+int TT_fuzzy( const TTree tree, const char *query, size_t max,
+              TT_KeyWalk walker, void *data )
+{
+    struct _TT_Fuzzy fuzzy;
+    char buf[TT_FOLD_SIZE];
+    const char *folded;
+    size_t i;
+    int rc = 0;
+
+    if( !tree || !tree->head || !query ) {
+        return 1;
+    }
+
+    memset( &fuzzy, 0, sizeof( fuzzy ) );
+    folded = _TT_fold( tree->flags, query, buf );
+
+    if( !folded ) {
+        return 0;
+    }
+
+    fuzzy.query = ( const unsigned char * ) folded;
+    fuzzy.qlen = strlen( folded );
+    fuzzy.max = max;
+    fuzzy.walker = walker;
+    fuzzy.data = data;
+    fuzzy.size = ( fuzzy.qlen + 1 ) * 16;
+    fuzzy.rows = Malloc( fuzzy.size * sizeof( size_t ) );
+
+    if( fuzzy.rows && _TT_keys_init( &fuzzy.keys, NULL, 0, tree->flags ) ) {
+        for( i = 0; i <= fuzzy.qlen; i++ ) {
+            fuzzy.rows[i] = i;
+        }
+
+        __lock( tree->lock );
+        rc = !_TT_fuzzy( tree->head->mid, &fuzzy );
+        __unlock( tree->lock );
+        Free( fuzzy.keys.key );
+    }
+
+    Free( fuzzy.rows );
+    _TT_unfold( query, folded, buf );
+    return rc;
+}
+
+/*
+ *  Pattern match stuff. Pattern is compiled to array of byte sets, literal
+ *  bytes are single-byte sets. Set bounds tell which of left and right
+ *  links can hold matching splitters, so literal pattern bytes follow one
+ *  path like TT_search() and only wildcards branch.
+ */
+struct _TT_Class {
+    unsigned char min;
+    unsigned char max;
+    unsigned char set[32];
+};
+
+struct _TT_Match {
+    struct _TT_Class *pattern;
+    size_t len;
+    struct _TT_Keys keys;
+    TT_KeyWalk walker;
+    void *data;
+};
+
+#define TT_IN_CLASS( cls, c ) ( ( cls )->set[( c ) >> 3] & ( 1 << ( ( c ) & 7 ) ) )
+
+static void _TT_class_add( struct _TT_Class *cls, unsigned char from,
+                           unsigned char to )
+{
+    unsigned c;
+
+    for( c = from; c <= to; c++ ) {
+        cls->set[c >> 3] |= 1 << ( c & 7 );
+    }
+}
+
+/*
+ *  Internal, parse pattern to classes: '?' is any byte, '[...]' is class
+ *  with ranges ('a-z') and negation ('[!...]' or '[^...]'), '\' escapes
+ *  next byte. Return number of classes.
+ */
+static size_t _TT_class_parse( struct _TT_Class *cls, const char *pattern )
+{
+    const unsigned char *s = ( const unsigned char * ) pattern;
+    size_t len = 0;
+
+    while( *s ) {
+        struct _TT_Class *ptr = cls + len++;
+        int negate = ( *s == '[' && ( s[1] == '!' || s[1] == '^' ) );
+        memset( ptr, 0, sizeof( struct _TT_Class ) );
+
+        if( *s == '?' ) {
+            _TT_class_add( ptr, 0, 255 );
+            s++;
+        }
+        else if( *s == '[' && s[1 + negate] &&
+                 strchr( ( const char * ) s + 2 + negate, ']' ) ) {
+            s += 1 + negate;
+
+            do {
+                unsigned char from = *s++;
+
+                if( *s == '-' && s[1] && s[1] != ']' ) {
+                    _TT_class_add( ptr, from, s[1] );
+                    s += 2;
+                }
+                else {
+                    _TT_class_add( ptr, from, from );
+                }
+            }
+            while( *s != ']' );
+
+            s++;
+
+            if( negate ) {
+                size_t i;
+
+                for( i = 0; i < sizeof( ptr->set ); i++ ) {
+                    ptr->set[i] = ~ptr->set[i];
+                }
+            }
+        }
+        else {
+            if( *s == '\\' && s[1] ) {
+                s++;
+            }
+
+            _TT_class_add( ptr, *s, *s );
+            s++;
+        }
+
+        ptr->min = 255;
+
+        while( ptr->min && !TT_IN_CLASS( ptr, ptr->min ) ) {
+            ptr->min--;
+        }
+
+        ptr->max = ptr->min;
+        ptr->min = 0;
+
+        while( ptr->min < ptr->max && !TT_IN_CLASS( ptr, ptr->min ) ) {
+            ptr->min++;
+        }
+    }
+
+    return len;
+}
+
+/*
+ *  Internal, 'pos' is index of class for node splitter. Return non-zero if
+ *  walker stopped walking (or memory allocation fails).
+ */
+static int _TT_match( TTNodeConst node, size_t pos, struct _TT_Match *match )
+{
+    const struct _TT_Class *cls;
+    size_t len, i;
+    int rc = 0;
+
+    if( !node || pos >= match->len ) {
+        return 0;
+    }
+
+    cls = match->pattern + pos;
+
+    if( cls->min < node->splitter && _TT_match( node->left, pos, match ) ) {
+        return 1;
+    }
+
+    if( TT_IN_CLASS( cls, node->splitter ) ) {
+        len = TT_RLEN( node );
+
+        for( i = 0; i < len && pos + 1 + i < match->len; i++ ) {
+            unsigned char c = ( unsigned char ) TT_RUN( node )[i];
+
+            if( !TT_IN_CLASS( match->pattern + pos + 1 + i, c ) ) {
+                break;
+            }
+        }
+
+        if( i == len ) {
+            len = _TT_keys_push( &match->keys, node );
+
+            if( !len ) {
+                return 1;
+            }
+
+            if( pos + len == match->len ) {
+                rc = ( node->flags & TN_KEY ) ?
+                     match->walker( match->keys.key, match->keys.len, node,
+                                    match->data ) : 0;
+            }
+            else {
+                rc = _TT_match( node->mid, pos + len, match );
+            }
+
+            _TT_keys_pop( &match->keys, len );
+
+            if( rc ) {
+                return rc;
+            }
+        }
+    }
+
+    return ( cls->max > node->splitter ) ?
+           _TT_match( node->right, pos, match ) : 0;
+}
+
+int TT_match( const TTree tree, const char *pattern, TT_KeyWalk walker,
+              void *data )
+{
+    struct _TT_Match match;
+    char buf[TT_FOLD_SIZE];
+    const char *folded;
+    int rc = 0;
+
+    if( !tree || !tree->head || !pattern || !*pattern ) {
+        return 1;
+    }
+
+    folded = _TT_fold( tree->flags, pattern, buf );
+
+    if( !folded ) {
+        return 0;
+    }
+
+    memset( &match, 0, sizeof( match ) );
+    match.walker = walker;
+    match.data = data;
+    match.pattern = Malloc( strlen( folded ) * sizeof( struct _TT_Class ) );
+
+    if( match.pattern && _TT_keys_init( &match.keys, NULL, 0, tree->flags ) ) {
+        match.len = _TT_class_parse( match.pattern, folded );
+        __lock( tree->lock );
+        rc = !_TT_match( tree->head->mid, 0, &match );
+        __unlock( tree->lock );
+        Free( match.keys.key );
+    }
+
+    Free( match.pattern );
+    _TT_unfold( pattern, folded, buf );
+    return rc;
+}
+
+/*
+ *  Prefix cursor stuff. In-order walk with explicit stack, frame state is:
+ *  0 - go left, 1 - visit node, 2 - go mid, 3 - go right (frame is reused).
+ *  Stack and key live in cursor and spill to heap only if they overflow.
+ */
+static int _TT_cursor_key( TT_Cursor *cursor, size_t len )
+{
+    if( cursor->ksize < len + 1 ) {
+        size_t size = cursor->ksize * 2;
+        char *key;
+
+        while( size < len + 1 ) {
+            size *= 2;
+        }
+
+        key = ( cursor->key == cursor->buf ) ? Malloc( size ) :
+              Realloc( cursor->key, size );
+
+        if( !key ) {
+            cursor->error = TE_MEMORY;
+            cursor->depth = 0;
+            return 0;
+        }
+
+        if( cursor->key == cursor->buf ) {
+            memcpy( key, cursor->buf, cursor->len + 1 );
+        }
+
+        cursor->key = key;
+        cursor->ksize = size;
+    }
+
+    return 1;
+}
+
+static int _TT_cursor_push( TT_Cursor *cursor, TTNodeConst node, size_t len )
+{
+    struct _TT_Frame *frame;
+
+    if( cursor->depth == cursor->size ) {
+        size_t size = cursor->size * 2 * sizeof( struct _TT_Frame );
+        frame = ( cursor->stack == cursor->frames ) ? Malloc( size ) :
+                Realloc( cursor->stack, size );
+
+        if( !frame ) {
+            cursor->error = TE_MEMORY;
+            cursor->depth = 0;
+            return 0;
+        }
+
+        if( cursor->stack == cursor->frames ) {
+            memcpy( frame, cursor->frames, sizeof( cursor->frames ) );
+        }
+
+        cursor->stack = frame;
+        cursor->size *= 2;
+    }
+
+    frame = cursor->stack + cursor->depth++;
+    frame->node = node;
+    frame->len = len;
+    frame->state = 0;
+    return 1;
+}
+
+/*
+ *  Start cursor at position (node, off): node splitter and 'off' bytes of its
+ *  run are matched by prefix. NULL node means no matches.
+ */
+void _TT_cursor_init( TT_Cursor *cursor, TTNodeConst node, size_t off,
+                      const char *prefix, size_t len, Tree_Flags flags )
+{
+    size_t rlen = node ? TT_RLEN( node ) : 0;
+    cursor->key = cursor->buf;
+    cursor->ksize = TT_CURSOR_KEY;
+    cursor->stack = cursor->frames;
+    cursor->size = TT_CURSOR_DEPTH;
+    cursor->depth = 0;
+    cursor->error = TE_NO_ERROR;
+    cursor->self = NULL;
+    cursor->len = 0;
+    cursor->key[0] = 0;
+
+    if( !node || !_TT_cursor_key( cursor, len + rlen ) ) {
+        return;
+    }
+
+    if( flags & T_NOCASE ) {
+        T_Fold( cursor->key, prefix, len );
+    }
+    else if( len ) {
+        memcpy( cursor->key, prefix, len );
+    }
+
+    cursor->len = len;
+
+    if( off < rlen ) {
+        memcpy( cursor->key + len, TT_RUN( node ) + off, rlen - off );
+        cursor->len += rlen - off;
+        cursor->self = node;
+    }
+
+    cursor->key[cursor->len] = 0;
+
+    if( ( node = TT_LOAD( node->mid ) ) != NULL ) {
+        _TT_cursor_push( cursor, node, cursor->len );
+    }
+}
+
+int TT_prefix_cursor( const TTree tree, const char *prefix,
+                      TT_Cursor *cursor )
+{
+    TTNode node = NULL;
+    size_t off = 0, len = 0;
+
+    if( tree && tree->head ) {
+        if( prefix && *prefix ) {
+            len = strlen( prefix );
+            node = __TT_lookup( TT_LOAD( tree->head->mid ), prefix, len,
+                                tree->flags, &off );
+        }
+        else {
+            node = tree->head;
+        }
+    }
+
+    _TT_cursor_init( cursor, node, off, prefix, len,
+                     tree ? tree->flags : T_NO_FLAGS );
+    return node && cursor->error == TE_NO_ERROR;
+}
+
+TTNodeConst TT_prefix_next( TT_Cursor *cursor )
+{
+    if( cursor->self ) {
+        TTNodeConst node = cursor->self;
+        cursor->self = NULL;
+
+        if( TT_LOAD( node->flags ) & TN_KEY ) {
+            return node;
+        }
+    }
+
+    while( cursor->depth ) {
+        struct _TT_Frame *frame = cursor->stack + cursor->depth - 1;
+        TTNodeConst node = frame->node, next;
+        size_t len = TT_RLEN( node );
+
+        switch( frame->state++ ) {
+            case 0:
+                if( ( next = TT_LOAD( node->left ) ) != NULL ) {
+                    _TT_cursor_push( cursor, next, frame->len );
+                }
+
+                break;
+
+            case 1:
+                if( !_TT_cursor_key( cursor, frame->len + len + 1 ) ) {
+                    return NULL;
+                }
+
+                cursor->len = frame->len;
+                cursor->key[cursor->len++] = node->splitter;
+
+                if( len ) {
+                    memcpy( cursor->key + cursor->len, TT_RUN( node ), len );
+                    cursor->len += len;
+                }
+
+                cursor->key[cursor->len] = 0;
+
+                if( TT_LOAD( node->flags ) & TN_KEY ) {
+                    return node;
+                }
+
+                break;
+
+            case 2:
+                if( ( next = TT_LOAD( node->mid ) ) == NULL ) {
+                    break;
+                }
+
+                if( !TT_LOAD( node->right ) ) {
+                    /* nothing left in this frame, reuse it */
+                    frame->node = next;
+                    frame->len += len + 1;
+                    frame->state = 0;
+                }
+                else {
+                    _TT_cursor_push( cursor, next, frame->len + len + 1 );
+                }
+
+                break;
+
+            default:
+                if( ( next = TT_LOAD( node->right ) ) != NULL ) {
+                    frame->node = next;
+                    frame->state = 0;
+                }
+                else {
+                    cursor->depth--;
+                }
+        }
+    }
+
+    return NULL;
+}
+
+void TT_prefix_close( TT_Cursor *cursor )
+{
+    if( cursor->key != cursor->buf ) {
+        Free( cursor->key );
+        cursor->key = cursor->buf;
+        cursor->ksize = TT_CURSOR_KEY;
+    }
+
+    if( cursor->stack != cursor->frames ) {
+        Free( cursor->stack );
+        cursor->stack = cursor->frames;
+        cursor->size = TT_CURSOR_DEPTH;
+    }
+
+    cursor->depth = 0;
+    cursor->self = NULL;
+}
+
+/*
+ *  Internal, count matches with cursor. Caller holds the lock or read
+ *  section.
+ */
+static size_t _TT_prefix_count( const TTree tree, const char *prefix )
+{
+    TT_Cursor cursor;
+    size_t count = 0;
+    TT_prefix_cursor( tree, prefix, &cursor );
+
+    while( TT_prefix_next( &cursor ) ) {
+        count++;
+    }
+
+    TT_prefix_close( &cursor );
+    return count;
+}
+
+size_t TT_prefix_count( const TTree tree, const char *prefix )
+{
+    size_t count;
+    int token = 0;
+
+    if( !tree || !tree->head ) {
+        return 0;
+    }
+
+    if( tree->epoch ) {
+        token = _TT_read_begin( tree->epoch );
+    }
+    else {
+        __lock( tree->lock );
+    }
+
+    count = _TT_prefix_count( tree, prefix );
+
+    if( tree->epoch ) {
+        _TT_read_end( tree->epoch, token );
+    }
+    else {
+        __unlock( tree->lock );
+    }
+
+    return count;
+}
+
+size_t TT_count_prefix( const TTree tree, const char *prefix )
+{
+    TTNode node;
+    size_t off = 0, count = 0;
+    int token = 0;
+
+    if( !tree || !tree->head ) {
+        return 0;
+    }
+
+    if( tree->epoch ) {
+        token = _TT_read_begin( tree->epoch );
+    }
+    else {
+        __lock( tree->lock );
+    }
+
+    node = TT_LOAD( tree->head->mid );
+
+    /*
+     * Trees without counters count matches with cursor:
+     */
+    if( !( tree->flags & T_COUNTS ) ) {
+        count = _TT_prefix_count( tree, prefix );
+        node = NULL;
+    }
+    else if( prefix && *prefix ) {
+        node = __TT_lookup( node, prefix, strlen( prefix ), tree->flags, &off );
+
+        /*
+         * Node key is longer than prefix if prefix ends inside node run:
+         */
+        if( node ) {
+            count = ( off < TT_RLEN( node ) &&
+                      ( TT_LOAD( node->flags ) & TN_KEY ) ) ? 1 : 0;
+            node = TT_LOAD( node->mid );
+        }
+    }
+
+    count += TT_KEYS( node, tree->flags );
+
+    if( tree->epoch ) {
+        _TT_read_end( tree->epoch, token );
+    }
+    else {
+        __unlock( tree->lock );
+    }
+
+    return count;
+}
+
+/*
+ *  Collect keys to allocated array. Keys are stored in the same memory
+ *  block, so it must be freed with single free(). Array is sized exactly:
+ *  first pass counts keys and key lengths, second one fills array.
+ */
+void *_TT_collect( TTNodeConst node, size_t off, const char *prefix,
+                   size_t len, Tree_Flags flags, size_t max, int strings,
+                   size_t *count )
+{
+    TT_Cursor cursor;
+    size_t esize = strings ? sizeof( char * ) : sizeof( struct _TT_Data );
+    size_t idx = 0, size = 0;
+    char *data, *ptr;
+
+    if( count ) {
+        *count = 0;
+    }
+
+    _TT_cursor_init( &cursor, node, off, prefix, len, flags );
+
+    while( idx < max && TT_prefix_next( &cursor ) ) {
+        idx++;
+        size += cursor.len + 1;
+    }
+
+    if( cursor.error != TE_NO_ERROR ) {
+        TT_prefix_close( &cursor );
+        return NULL;
+    }
+
+    data = Calloc( esize * ( idx + 1 ) + size, 1 );
+
+    if( data && idx ) {
+        ptr = data + esize * ( idx + 1 );
+        max = idx;
+        idx = 0;
+        TT_prefix_close( &cursor );
+        _TT_cursor_init( &cursor, node, off, prefix, len, flags );
+
+        while( idx < max && ( node = TT_prefix_next( &cursor ) ) != NULL ) {
+            memcpy( ptr, cursor.key, cursor.len + 1 );
+
+            if( strings ) {
+                ( ( char ** ) data )[idx] = ptr;
+            }
+            else {
+                ( ( TT_Data ) data )[idx].key = ptr;
+                ( ( TT_Data ) data )[idx].data = TT_LOAD( node->data );
+                ( ( TT_Data ) data )[idx].len = cursor.len;
+            }
+
+            ptr += cursor.len + 1;
+            idx++;
+        }
+    }
+
+    TT_prefix_close( &cursor );
+
+    if( data && count ) {
+        *count = idx;
+    }
+
+    return data;
+}
+
+/*
+ *  Top-k stuff. Best-first search over subtree maximums: heap holds whole
+ *  subtrees (node with its left and right siblings) and single keys, so
+ *  subtrees which can not beat k-th result are never expanded. Keys are
+ *  rebuilt from trail, list of 'mid' steps linked to parents.
+ */
+#define TT_RANK_TREE 0
+#define TT_RANK_KEY  1
+#define TT_RANK_SELF 2  /* start node itself, its bytes are in base key */
+#define TT_NO_TRAIL ( ( size_t ) - 1 )
+
+struct _TT_Rank {
+    size_t weight;
+    TTNodeConst node;
+    size_t trail;
+    int type;
+};
+
+struct _TT_Trail {
+    TTNodeConst node;
+    size_t parent;
+};
+
+struct _TT_Topk {
+    struct _TT_Rank *heap;
+    size_t count;
+    size_t size;
+    struct _TT_Trail *trail;
+    size_t tcount;
+    size_t tsize;
+};
+
+static int _TT_rank_push( struct _TT_Topk *topk, size_t weight,
+                          TTNodeConst node, size_t trail, int type )
+{
+    size_t i;
+
+    if( topk->count == topk->size ) {
+        size_t size = topk->size ? topk->size * 2 : 64;
+        struct _TT_Rank *heap = Realloc( topk->heap,
+                                         size * sizeof( struct _TT_Rank ) );
+
+        if( !heap ) {
+            return 0;
+        }
+
+        topk->heap = heap;
+        topk->size = size;
+    }
+
+    i = topk->count++;
+
+    while( i && topk->heap[( i - 1 ) / 2].weight < weight ) {
+        topk->heap[i] = topk->heap[( i - 1 ) / 2];
+        i = ( i - 1 ) / 2;
+    }
+
+    topk->heap[i].weight = weight;
+    topk->heap[i].node = node;
+    topk->heap[i].trail = trail;
+    topk->heap[i].type = type;
+    return 1;
+}
+
+static struct _TT_Rank _TT_rank_pop( struct _TT_Topk *topk )
+{
+    struct _TT_Rank top = topk->heap[0];
+    struct _TT_Rank last = topk->heap[--topk->count];
+    size_t i = 0, child;
+
+    while( ( child = i * 2 + 1 ) < topk->count ) {
+        if( child + 1 < topk->count &&
+                topk->heap[child + 1].weight > topk->heap[child].weight ) {
+            child++;
+        }
+
+        if( topk->heap[child].weight <= last.weight ) {
+            break;
+        }
+
+        topk->heap[i] = topk->heap[child];
+        i = child;
+    }
+
+    if( topk->count ) {
+        topk->heap[i] = last;
+    }
+
+    return top;
+}
+
+static size_t _TT_trail_push( struct _TT_Topk *topk, TTNodeConst node,
+                              size_t parent )
+{
+    if( topk->tcount == topk->tsize ) {
+        size_t size = topk->tsize ? topk->tsize * 2 : 64;
+        struct _TT_Trail *trail = Realloc( topk->trail,
+                                           size * sizeof( struct _TT_Trail ) );
+
+        if( !trail ) {
+            return TT_NO_TRAIL;
+        }
+
+        topk->trail = trail;
+        topk->tsize = size;
+    }
+
+    topk->trail[topk->tcount].node = node;
+    topk->trail[topk->tcount].parent = parent;
+    return topk->tcount++;
+}
+
+/*
+ *  Internal, get key length (without base key) or write key bytes before
+ *  'end' if it is not NULL:
+ */
+static size_t _TT_rank_key( const struct _TT_Topk *topk,
+                            const struct _TT_Rank *rank, char *end )
+{
+    size_t len = 0, trail = rank->trail;
+    TTNodeConst node = ( rank->type == TT_RANK_KEY ) ? rank->node : NULL;
+
+    while( node ) {
+        size_t rlen = TT_RLEN( node );
+        len += rlen + 1;
+
+        if( end ) {
+            end -= rlen + 1;
+            *end = node->splitter;
+
+            if( rlen ) {
+                memcpy( end + 1, TT_RUN( node ), rlen );
+            }
+        }
+
+        node = ( trail == TT_NO_TRAIL ) ? NULL : topk->trail[trail].node;
+        trail = node ? topk->trail[trail].parent : TT_NO_TRAIL;
+    }
+
+    return len;
+}
+
+static size_t _TT_topk( TTNodeConst node, size_t off, const char *prefix,
+                        size_t len, size_t k, TT_Data *out )
+{
+    struct _TT_Topk topk;
+    struct _TT_Rank *found = NULL;
+    size_t count = 0, size = 0, rlen = TT_RLEN( node ), i;
+    char *key;
+    int rc = 1;
+    memset( &topk, 0, sizeof( topk ) );
+
+    if( off < rlen && ( node->flags & TN_KEY ) ) {
+        rc = _TT_rank_push( &topk, TT_WEIGHT( node )->weight, node,
+                            TT_NO_TRAIL, TT_RANK_SELF );
+    }
+
+    if( rc && node->mid ) {
+        rc = _TT_rank_push( &topk, TT_MAX( node->mid ), node->mid,
+                            TT_NO_TRAIL, TT_RANK_TREE );
+    }
+
+    found = Malloc( sizeof( struct _TT_Rank ) * ( k < 64 ? k : 64 ) );
+    rc = rc && found;
+
+    while( rc && count < k && topk.count ) {
+        struct _TT_Rank rank = _TT_rank_pop( &topk );
+        TTNodeConst ptr = rank.node;
+
+        if( rank.type != TT_RANK_TREE ) {
+            if( count >= 64 && !( count & ( count - 1 ) ) ) {
+                size_t bytes = count * 2 * sizeof( struct _TT_Rank );
+                struct _TT_Rank *tmp = Realloc( found, bytes );
+
+                if( !tmp ) {
+                    rc = 0;
+                    break;
+                }
+
+                found = tmp;
+            }
+
+            found[count++] = rank;
+            size += len + ( off < rlen ? rlen - off : 0 ) +
+                    _TT_rank_key( &topk, &rank, NULL ) + 1;
+            continue;
+        }
+
+        if( ptr->left ) {
+            rc = _TT_rank_push( &topk, TT_MAX( ptr->left ), ptr->left,
+                                rank.trail, TT_RANK_TREE );
+        }
+
+        if( rc && ptr->right ) {
+            rc = _TT_rank_push( &topk, TT_MAX( ptr->right ), ptr->right,
+                                rank.trail, TT_RANK_TREE );
+        }
+
+        if( rc && ( ptr->flags & TN_KEY ) ) {
+            rc = _TT_rank_push( &topk, TT_WEIGHT( ptr )->weight, ptr,
+                                rank.trail, TT_RANK_KEY );
+        }
+
+        if( rc && ptr->mid ) {
+            size_t trail = _TT_trail_push( &topk, ptr, rank.trail );
+            rc = ( trail != TT_NO_TRAIL ) &&
+                 _TT_rank_push( &topk, TT_MAX( ptr->mid ), ptr->mid, trail,
+                                TT_RANK_TREE );
+        }
+    }
+
+    *out = NULL;
+
+    if( rc && count ) {
+        *out = Calloc( sizeof( struct _TT_Data ) * ( count + 1 ) + size, 1 );
+    }
+
+    if( *out ) {
+        key = ( char * )( *out + count + 1 );
+
+        for( i = 0; i < count; i++ ) {
+            size_t klen = _TT_rank_key( &topk, found + i, NULL );
+            ( *out )[i].key = key;
+            ( *out )[i].data = found[i].node->data;
+
+            if( len ) {
+                memcpy( key, prefix, len );
+                key += len;
+            }
+
+            if( off < rlen ) {
+                memcpy( key, TT_RUN( node ) + off, rlen - off );
+                key += rlen - off;
+            }
+
+            key += klen;
+            _TT_rank_key( &topk, found + i, key );
+            ( *out )[i].len = key - ( *out )[i].key;
+            *key++ = 0;
+        }
+    }
+
+    Free( found );
+    Free( topk.heap );
+    Free( topk.trail );
+    return *out ? count : 0;
+}
+
+size_t TT_topk( const TTree tree, const char *prefix, size_t k,
+                TT_DataConst *out )
+{
+    TTNode node = NULL;
+    TT_Data data = NULL;
+    size_t off = 0, len = 0, count = 0;
+    char buf[TT_FOLD_SIZE];
+    const char *folded;
+
+    if( !tree || !tree->head || !out || !k ) {
+        if( out ) {
+            *out = NULL;
+        }
+
+        return 0;
+    }
+
+    __lock( tree->lock );
+    folded = _TT_fold( tree->flags, prefix, buf );
+
+    if( folded && *folded ) {
+        len = strlen( folded );
+        node = _TT_follow( tree->head->mid, folded, len, &off );
+    }
+    else if( !prefix || !*prefix ) {
+        node = tree->head;
+    }
+
+    if( node && ( tree->flags & T_WEIGHTS ) ) {
+        count = _TT_topk( node, off, folded, len, k, &data );
+    }
+    else if( node ) {
+        data = _TT_collect( node, off, folded, len, T_NO_FLAGS, k, 0,
+                            &count );
+    }
+
+    _TT_unfold( prefix, folded, buf );
+    __unlock( tree->lock );
+    *out = data;
+    return data ? count : 0;
+}
+
+/*
+ *  Get sorted data from tree:
+ */
+TT_DataConst TT_data( const TTree tree, size_t *count )
+{
+    TT_Data data;
+
+    if( count ) {
+        *count = 0;
+    }
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    __lock( tree->lock );
+    data = _TT_collect( tree->head, 0, NULL, 0, tree->flags,
+                        ( ( size_t ) - 1 ), 0, count );
+    __unlock( tree->lock );
+    return data;
+}
+
+char **TS_data( const TTree tree, size_t *count )
+{
+    char **data;
+
+    if( count ) {
+        *count = 0;
+    }
+
+    if( !tree ) {
+        return NULL;
+    }
+
+    __lock( tree->lock );
+    data = _TT_collect( tree->head, 0, NULL, 0, tree->flags,
+                        ( ( size_t ) - 1 ), 1, count );
+    __unlock( tree->lock );
+    return data;
+}
+
+/*
+ *  Dump tree stuff:
+ */
+static void _TT_dump( const TTree tree, const TTNode node,
+                      Tree_DataDump dumper, char *indent,
+                      struct _TT_Keys *keys, int last, FILE *handle )
+{
+    size_t strip = 0;
+
+    /*
+     * Head is not printed, binary key node may have zero splitter:
+     */
+    if( node != tree->head ) {
+        size_t i, len = _TT_keys_push( keys, node );
+        strip = T_Indent( indent, last, handle );
+
+        for( i = keys->len - len; i < keys->len; i++ ) {
+            fprintf( handle, "%c",
+                     isprint( ( unsigned char ) keys->key[i] ) ? keys->key[i] : '?' );
+        }
+
+        if( node->flags & TN_KEY ) {
+            fprintf( handle, " => [" );
+            fwrite( keys->key, 1, keys->len, handle );
+            fprintf( handle, "]" );
+        }
+        else {
+            fprintf( handle, " => ()" );
+        }
+
+        if( dumper ) {
+            dumper( node->data, handle );
+        }
+
+        fprintf( handle, "\n" );
+        _TT_keys_pop( keys, len );
+    }
+
+    if( node->left ) _TT_dump( tree, node->left, dumper, indent, keys,
+                                   ( node->right || node->mid ) ? 0 : 1, handle );
+
+    if( node->mid ) {
+        size_t len = ( node != tree->head ) ? _TT_keys_push( keys, node ) : 0;
+        _TT_dump( tree, node->mid, dumper, indent, keys, node->right ? 0 : 1,
+                  handle );
+        _TT_keys_pop( keys, len );
+    }
+
+    if( node->right ) {
+        _TT_dump( tree, node->right, dumper, indent, keys, 1, handle );
+    }
+
+    if( strip ) {
+        indent[strip] = 0;
+    }
+}
+
+int TT_dump( TTree tree, Tree_DataDump dumper, FILE *handle )
+{
+    size_t depth = TT_depth( tree );
+    char *buf = Calloc( depth + 1, 2 );
+    struct _TT_Keys keys;
+
+    if( buf && _TT_keys_init( &keys, NULL, 0, tree->flags ) ) {
+        fprintf( handle, "nodes: %zu, keys: %zu, depth: %zu\n",
+                 tree->nodes/*TT_nodes( tree )*/, tree->keys/*TT_keys( tree )*/,
+                 depth );
+        __lock( tree->lock );
+        _TT_dump( tree, tree->head, dumper, buf, &keys, 0, handle );
+        __unlock( tree->lock );
+        Free( keys.key );
+        Free( buf );
+        return 1;
+    }
+
+    Free( buf );
+    return 0;
+}
+
+/*
+ *  Lookup stuff:
+ */
+void *_TT_lookup( TTree tree, const char *prefix, size_t len, size_t max,
+                  int strings, size_t *count )
+{
+    TTNode node;
+    void *data = NULL;
+    size_t off;
+    int token;
+
+    if( count ) {
+        *count = 0;
+    }
+
+    if( !tree || !prefix || !len ) {
+        return NULL;
+    }
+
+    token = TT_read_begin( tree );
+    node = __TT_lookup( TT_LOAD( tree->head->mid ), prefix, len, tree->flags,
+                        &off );
+
+    if( node && ( off < TT_RLEN( node ) || TT_LOAD( node->mid ) ) ) {
+        data = _TT_collect( node, off, prefix, len, tree->flags,
+                            max ? max : ( ( size_t ) - 1 ), strings, count );
+    }
+
+    TT_read_end( tree, token );
+    return data;
+}
+
+TTree TT_lookup_tree( TTree tree, const char *prefix )
+{
+    /*
+     * Cursor keys are temporary, copy runs:
+     */
+    TTree rc = TT_create( tree->flags & ~T_STATIC_KEYS, NULL );
+    TT_Cursor cursor;
+    TTNodeConst node;
+
+    if( !rc ) {
+        return NULL;
+    }
+
+    __lock( tree->lock );
+
+    if( prefix && *prefix ) {
+        TT_prefix_cursor( tree, prefix, &cursor );
+
+        while( ( node = TT_prefix_next( &cursor ) ) != NULL ) {
+            TTNode copy = _TT_insert( rc, cursor.key, cursor.len, node->data );
+
+            if( copy && ( rc->flags & T_WEIGHTS ) ) {
+                _TT_reweigh( rc, cursor.key, cursor.len, copy,
+                             TT_WEIGHT( node )->weight );
+            }
+        }
+
+        TT_prefix_close( &cursor );
+    }
+
+    __unlock( tree->lock );
+    return rc;
+}
+
+/*
+ *  Set operations stuff. Tree 'a' is walked, and position in tree 'b' (node
+ *  and number of its run bytes passed) follows walked key byte by byte, so
+ *  shared prefixes are compared once. Subtree of 'a' with no counterpart in
+ *  'b' is collected (or skipped) whole, merge copies it to free link of 'b'
+ *  directly if both trees keep keys the same way. Other keys are collected
+ *  in ascending order and then inserted with _TT_build().
+ */
+#define TT_SET_MERGE     0
+#define TT_SET_INTERSECT 1
+#define TT_SET_DIFF      2
+
+struct _TT_Item {
+    size_t off;
+    size_t len;
+    void *data;
+    size_t weight;
+};
+
+struct _TT_Set {
+    int op;
+    int replace;
+    TTree dst;          /* merge: missing subtrees are copied here */
+    struct _TT_Keys keys;
+    struct _TT_Item *items;
+    size_t count;
+    size_t size;
+    char *blob;
+    size_t used;
+    size_t bsize;
+};
+
+static int _TT_set_add( const char *key, size_t len, TTNodeConst node,
+                        void *data )
+{
+    struct _TT_Set *set = data;
+
+    if( set->count == set->size ) {
+        size_t size = set->size ? set->size * 2 : 64;
+        struct _TT_Item *items = Realloc( set->items,
+                                          size * sizeof( struct _TT_Item ) );
+
+        if( !items ) {
+            return 1;
+        }
+
+        set->items = items;
+        set->size = size;
+    }
+
+    if( set->used + len + 1 > set->bsize ) {
+        size_t size = set->bsize ? set->bsize : 1024;
+        char *blob;
+
+        while( size < set->used + len + 1 ) {
+            size *= 2;
+        }
+
+        blob = Realloc( set->blob, size );
+
+        if( !blob ) {
+            return 1;
+        }
+
+        set->blob = blob;
+        set->bsize = size;
+    }
+
+    memcpy( set->blob + set->used, key, len );
+    set->blob[set->used + len] = 0;
+    set->items[set->count].off = set->used;
+    set->items[set->count].len = len;
+    set->items[set->count].data = node->data;
+    set->items[set->count].weight = TT_weight( node );
+    set->used += len + 1;
+    set->count++;
+    return 0;
+}
+
+/*
+ *  Internal, move position in 'b' by one byte. Return 0 if 'b' has no such
+ *  continuation.
+ */
+static int _TT_set_step( TTNodeConst *node, size_t *off, unsigned char c )
+{
+    TTNodeConst next;
+
+    if( *off < TT_RLEN( *node ) ) {
+        if( ( unsigned char ) TT_RUN( *node )[*off] != c ) {
+            return 0;
+        }
+
+        ( *off )++;
+        return 1;
+    }
+
+    next = ( *node )->mid;
+
+    while( next && c != next->splitter ) {
+        next = ( c < next->splitter ) ? next->left : next->right;
+    }
+
+    if( !next ) {
+        return 0;
+    }
+
+    *node = next;
+    *off = 0;
+    return 1;
+}
+
+/*
+ *  Internal, copy node of other tree with its 'mid' subtree (with 'left' and
+ *  'right' links too, if 'links' is set), count copied nodes and keys.
+ *  Return NULL if memory allocation fails.
+ */
+static TTNode _TT_set_copy( TTree tree, TTNodeConst node, int links,
+                            size_t *nodes, size_t *keys )
+{
+    const char *run;
+    size_t len = _TT_run( node, &run );
+    TTNode copy = _TT_create_run( tree, node->splitter, run, len, 0 );
+
+    if( !copy ) {
+        return NULL;
+    }
+
+    ( *nodes )++;
+
+    if( node->flags & TN_KEY ) {
+        copy->flags |= TN_KEY;
+        copy->data = node->data;
+        ( *keys )++;
+    }
+
+    if( tree->flags & T_WEIGHTS ) {
+        TT_WEIGHT( copy )->weight = TT_weight( node );
+    }
+
+    if( ( node->mid && !( copy->mid = _TT_set_copy( tree, node->mid, 1, nodes,
+                          keys ) ) ) ||
+            ( links && node->left &&
+              !( copy->left = _TT_set_copy( tree, node->left, 1, nodes,
+                                            keys ) ) ) ||
+            ( links && node->right &&
+              !( copy->right = _TT_set_copy( tree, node->right, 1, nodes,
+                                             keys ) ) ) ) {
+        _TT_free_nodes( copy );
+        return NULL;
+    }
+
+    _TT_refresh( copy, tree->flags );
+    return copy;
+}
+
+/*
+ *  Internal, find free link of key whose last byte only is not in tree, and
+ *  its level:
+ */
+static TTNode *_TT_set_link( TTree tree, const char *key, size_t *level )
+{
+    const unsigned char *s = ( const unsigned char * ) key;
+    TTNode *link = &tree->head->mid, node;
+
+    *level = 0;
+
+    while( ( node = *link ) != NULL ) {
+        if( s[0] < node->splitter ) {
+            link = &node->left;
+            ( *level )++;
+        }
+        else if( s[0] > node->splitter ) {
+            link = &node->right;
+            ( *level )++;
+        }
+        else {
+            s += 1 + TT_RLEN( node );
+            *level += 1 + TT_RLEN( node );
+            link = &node->mid;
+        }
+    }
+
+    return link;
+}
+
+/*
+ *  Internal, copy merged node (with its 'mid' subtree) to 'dst', where key
+ *  collected so far has no continuation by node splitter. Return non-zero
+ *  if memory allocation fails.
+ */
+static int _TT_set_graft( struct _TT_Set *set, TTNodeConst node )
+{
+    TTree tree = set->dst;
+    size_t nodes = 0, keys = 0, level, len = set->keys.len + 1;
+    size_t pushed = _TT_keys_push( &set->keys, node );
+    TTNode *link, copy;
+    int rc = 1;
+
+    if( !pushed ) {
+        return 1;
+    }
+
+    link = _TT_set_link( tree, set->keys.key, &level );
+    copy = _TT_set_copy( tree, node, 0, &nodes, &keys );
+
+    if( copy && _TT_levels( tree, level + _TT_depth( copy, 0 ) ) ) {
+        /*
+         * Counters of path to free link are updated before it is set:
+         */
+        if( tree->flags & T_COUNTS ) {
+            _TT_count_path( tree, set->keys.key, len, keys, 1 );
+        }
+
+        _TT_stat_branch( tree, copy, level, 1 );
+        tree->nodes += nodes;
+        tree->keys += keys;
+        tree->changes++;
+        TT_STORE( *link, copy );
+        rc = ( tree->flags & T_WEIGHTS ) &&
+             !_TT_reweigh( tree, set->keys.key, len, NULL, 0 );
+    }
+    else if( copy ) {
+        _TT_free_nodes( copy );
+    }
+
+    _TT_keys_pop( &set->keys, pushed );
+    return rc;
+}
+
+/*
+ *  Walk splitter tree 'node' of 'a' against position 'b', 'off' in 'b'.
+ *  Return non-zero if memory allocation fails.
+ */
+static int _TT_set( struct _TT_Set *set, TTNodeConst node, TTNodeConst b,
+                    size_t off )
+{
+    while( node ) {
+        TTNodeConst bnode = b;
+        size_t i, len, boff = off, rlen = TT_RLEN( node );
+        int found, rc = 0;
+
+        if( _TT_set( set, node->left, b, off ) ) {
+            return 1;
+        }
+
+        found = _TT_set_step( &bnode, &boff, node->splitter );
+
+        /*
+         * Merged subtree missing in 'dst' is copied there whole:
+         */
+        if( !found && set->dst && off == TT_RLEN( b ) ) {
+            if( _TT_set_graft( set, node ) ) {
+                return 1;
+            }
+
+            node = node->right;
+            continue;
+        }
+
+        for( i = 0; found && i < rlen; i++ ) {
+            found = _TT_set_step( &bnode, &boff, TT_RUN( node )[i] );
+        }
+
+        /*
+         * Nothing of this subtree is in 'b', intersection skips it:
+         */
+        if( found || set->op != TT_SET_INTERSECT ) {
+            int key = found && boff == TT_RLEN( bnode ) &&
+                      ( bnode->flags & TN_KEY );
+
+            len = _TT_keys_push( &set->keys, node );
+
+            if( !len ) {
+                return 1;
+            }
+
+            if( ( node->flags & TN_KEY ) &&
+                    ( set->op == TT_SET_INTERSECT ? key :
+                      ( !key || set->replace ) ) ) {
+                rc = _TT_set_add( set->keys.key, set->keys.len, node, set );
+            }
+
+            if( !rc ) {
+                rc = found ? _TT_set( set, node->mid, bnode, boff ) :
+                     _TT_walk_keys( node->mid, &set->keys, _TT_set_add, set );
+            }
+
+            _TT_keys_pop( &set->keys, len );
+
+            if( rc ) {
+                return rc;
+            }
+        }
+
+        node = node->right;
+    }
+
+    return 0;
+}
+
+/*
+ *  Internal, collect keys of 'a' against 'b' (both are locked) and insert
+ *  them into 'tree' (locked too). Return 0 if memory allocation fails.
+ */
+static int _TT_set_build( struct _TT_Set *set, TTree a, TTree b,
+                          TTree tree )
+{
+    const char **keys;
+    size_t *lens, i;
+    void **datas;
+    int rc = 0;
+
+    if( _TT_set( set, a->head->mid, b->head, 0 ) ) {
+        return 0;
+    }
+
+    if( !set->count ) {
+        return 1;
+    }
+
+    keys = Malloc( set->count * ( sizeof( char * ) + sizeof( size_t ) +
+                                  sizeof( void * ) ) );
+
+    if( !keys ) {
+        return 0;
+    }
+
+    lens = ( size_t * )( keys + set->count );
+    datas = ( void ** )( lens + set->count );
+
+    for( i = 0; i < set->count; i++ ) {
+        keys[i] = set->blob + set->items[i].off;
+        lens[i] = set->items[i].len;
+        datas[i] = set->items[i].data;
+    }
+
+    if( _TT_build( tree, keys, lens, datas, 0, set->count, 0 ) ) {
+        rc = 1;
+
+        /*
+         * Replaced key takes weight of its source too, even zero one:
+         */
+        for( i = 0; rc && ( tree->flags & T_WEIGHTS ) && i < set->count; i++ ) {
+            TTNode node = _TT_search( tree->head->mid, keys[i], lens[i],
+                                      tree->flags );
+
+            if( node && TT_WEIGHT( node )->weight != set->items[i].weight ) {
+                rc = _TT_reweigh( tree, keys[i], lens[i], node,
+                                  set->items[i].weight );
+            }
+        }
+    }
+
+    Free( keys );
+    return rc;
+}
+
+static int _TT_set_init( struct _TT_Set *set, int op, Tree_Flags flags )
+{
+    memset( set, 0, sizeof( struct _TT_Set ) );
+    set->op = op;
+    set->replace = op == TT_SET_MERGE && ( flags & T_INSERT_REPLACE );
+    return _TT_keys_init( &set->keys, NULL, 0, flags );
+}
+
+static void _TT_set_free( struct _TT_Set *set )
+{
+    Free( set->keys.key );
+    Free( set->items );
+    Free( set->blob );
+}
+
+/*
+ *  Internal, lock two different trees in address order.
+ */
+static void _TT_lock_pair( TTree a, TTree b )
+{
+    if( a < b ) {
+        __lock( a->lock );
+        __lock( b->lock );
+    }
+    else {
+        __lock( b->lock );
+        __lock( a->lock );
+    }
+}
+
+int TT_merge( const TTree dst, const TTree src )
+{
+    struct _TT_Set set;
+    int rc = 0;
+
+    if( !dst || !src || !dst->head || !src->head ) {
+        return 0;
+    }
+
+    if( dst == src ) {
+        return 1;
+    }
+
+    if( _TT_set_init( &set, TT_SET_MERGE, dst->flags ) ) {
+        /*
+         * Nodes are copied as is if they keep keys the same way:
+         */
+        if( !( ( dst->flags ^ src->flags ) & T_COMPRESS ) &&
+                ( !( dst->flags & T_NOCASE ) || ( src->flags & T_NOCASE ) ) ) {
+            set.dst = dst;
+        }
+
+        _TT_lock_pair( dst, src );
+        rc = _TT_set_build( &set, src, dst, dst );
+        __unlock( src->lock );
+        __unlock( dst->lock );
+    }
+
+    _TT_set_free( &set );
+    return rc;
+}
+
+static TTree _TT_set_tree( TTree a, TTree b, int op )
+{
+    struct _TT_Set set;
+    TTree rc;
+
+    if( !a || !b || !a->head || !b->head ) {
+        return NULL;
+    }
+
+    rc = TT_create( a->flags, NULL );
+
+    if( !rc ) {
+        return NULL;
+    }
+
+    if( !_TT_set_init( &set, op, a->flags ) ) {
+        _TT_set_free( &set );
+        TT_destroy( rc );
+        return NULL;
+    }
+
+    if( a == b ) {
+        __lock( a->lock );
+    }
+    else {
+        _TT_lock_pair( a, b );
+    }
+
+    if( !_TT_set_build( &set, a, b, rc ) ) {
+        TT_destroy( rc );
+        rc = NULL;
+    }
+
+    if( a != b ) {
+        __unlock( b->lock );
+    }
+
+    __unlock( a->lock );
+    _TT_set_free( &set );
+    return rc;
+}
+
+TTree TT_intersect( const TTree a, const TTree b )
+{
+    return _TT_set_tree( a, b, TT_SET_INTERSECT );
+}
+TTree TT_diff( const TTree a, const TTree b )
+{
+    return _TT_set_tree( a, b, TT_SET_DIFF );
+}
+
+/*
+ *  View stuff. View keeps folded prefix only, prefix node is found again on
+ *  every call (single descent), so view stays valid while tree is modified
+ *  and may be created before any key with its prefix is inserted.
+ */
+TT_View TT_view( const TTree tree, const char *prefix )
+{
+    size_t len = prefix ? strlen( prefix ) : 0;
+    TT_View view;
+
+    if( !tree || !tree->head ) {
+        return NULL;
+    }
+
+    view = Malloc( sizeof( struct _TT_View ) + len + 1 );
+
+    if( view ) {
+        view->tree = tree;
+        view->len = len;
+        view->prefix = ( char * )( view + 1 );
+
+        if( tree->flags & T_NOCASE ) {
+            T_Fold( view->prefix, prefix, len );
+        }
+        else if( len ) {
+            memcpy( view->prefix, prefix, len );
+        }
+
+        view->prefix[len] = 0;
+    }
+
+    return view;
+}
+
+void TT_view_close( TT_View view )
+{
+    Free( view );
+}
+
+/*
+ *  Internal, follow folded key 's' from position (node, *off), as in cursor.
+ *  Return node where key ends and set *off, or NULL.
+ */
+static TTNode _TT_view_follow( TTNode node, const char *key, size_t klen,
+                               size_t *off )
+{
+    const unsigned char *s = ( const unsigned char * ) key, *end = s + klen;
+    size_t len;
+
+    if( !node || !klen ) {
+        return node;
+    }
+
+    len = TT_RLEN( node );
+
+    while( *off < len && s < end &&
+            *s == ( unsigned char ) TT_RUN( node )[*off] ) {
+        ( *off )++;
+        s++;
+    }
+
+    if( s == end ) {
+        return node;
+    }
+
+    if( *off < len ) {
+        return NULL;
+    }
+
+    return _TT_follow( TT_LOAD( node->mid ), ( const char * ) s, end - s,
+                       off );
+}
+
+static TTNode _TT_view_node( TT_View view, const char *key, size_t *off )
+{
+    char buf[TT_FOLD_SIZE];
+    const char *folded;
+    TTNode node = view->tree->head;
+
+    *off = 0;
+
+    if( view->len ) {
+        node = _TT_follow( TT_LOAD( node->mid ), view->prefix, view->len,
+                           off );
+    }
+
+    if( !node || !key || !*key ) {
+        return node;
+    }
+
+    folded = _TT_fold( view->tree->flags, key, buf );
+    node = folded ? _TT_view_follow( node, folded, strlen( folded ), off ) :
+           NULL;
+    _TT_unfold( key, folded, buf );
+    return node;
+}
+
+TTNodeConst TT_view_search( const TT_View view, const char *key )
+{
+    TTNode node;
+    size_t off;
+    int token;
+
+    if( !view || !key || !*key ) {
+        return NULL;
+    }
+
+    if( !view->tree->epoch ) {
+        __lock( view->tree->lock );
+    }
+
+    token = TT_read_begin( view->tree );
+    node = _TT_view_node( view, key, &off );
+
+    if( node && ( off != TT_RLEN( node ) ||
+                  !( TT_LOAD( node->flags ) & TN_KEY ) ) ) {
+        node = NULL;
+    }
+
+    TT_read_end( view->tree, token );
+
+    if( !view->tree->epoch ) {
+        __unlock( view->tree->lock );
+    }
+
+    return node;
+}
+
+TT_DataConst TT_view_nlookup( const TT_View view, const char *prefix,
+                              size_t max, size_t *count )
+{
+    char buf[TT_FOLD_SIZE];
+    const char *folded;
+    void *data = NULL;
+    TTNode node;
+    size_t off;
+    int token;
+
+    if( count ) {
+        *count = 0;
+    }
+
+    if( !view ) {
+        return NULL;
+    }
+
+    folded = _TT_fold( view->tree->flags, prefix, buf );
+
+    if( prefix && !folded ) {
+        return NULL;
+    }
+
+    if( !view->tree->epoch ) {
+        __lock( view->tree->lock );
+    }
+
+    token = TT_read_begin( view->tree );
+    node = _TT_view_node( view, prefix, &off );
+
+    /*
+     * Cursor key starts with relative prefix, so keys come out relative:
+     */
+    if( node ) {
+        data = _TT_collect( node, off, folded, folded ? strlen( folded ) : 0,
+                            T_NO_FLAGS, max ? max : ( ( size_t ) - 1 ), 0,
+                            count );
+    }
+
+    TT_read_end( view->tree, token );
+
+    if( !view->tree->epoch ) {
+        __unlock( view->tree->lock );
+    }
+
+    _TT_unfold( prefix, folded, buf );
+    return data;
+}
+
+TT_DataConst TT_view_lookup( const TT_View view, const char *prefix,
+                             size_t *count )
+{
+    return TT_view_nlookup( view, prefix, 0, count );
+}
+
+int TT_view_walk_keys( const TT_View view, TT_KeyWalk walker, void *data )
+{
+    TT_Cursor cursor;
+    TTNodeConst node;
+    size_t off;
+    int rc = 1;
+
+    if( !view ) {
+        return 1;
+    }
+
+    __lock( view->tree->lock );
+    node = _TT_view_node( view, NULL, &off );
+    _TT_cursor_init( &cursor, node, off, NULL, 0, T_NO_FLAGS );
+
+    while( rc && ( node = TT_prefix_next( &cursor ) ) != NULL ) {
+        rc = !walker( cursor.key, cursor.len, node, data );
+    }
+
+    if( cursor.error != TE_NO_ERROR ) {
+        rc = 0;
+    }
+
+    TT_prefix_close( &cursor );
+    __unlock( view->tree->lock );
+    return rc;
+}
+
+/*
+ *  Compact stuff. Every first level branch (node with its 'mid' subtree) is
+ *  rebuilt from its sorted keys in private tree: keys are copied under the
+ *  lock, private tree is built without it, and is published with single
+ *  store if tree was not changed meanwhile ('changes' counter, bumped by
+ *  every writer). Then first level nodes are copied to balanced splitter
+ *  tree, nodes without keys are dropped. Arena chunks which were in use
+ *  when compaction started are freed if every branch is rebuilt.
+ */
+#ifndef TT_COMPACT_TRIES
+# define TT_COMPACT_TRIES 4
+#endif
+
+struct _TT_Branch {
+    const char **keys;
+    void **datas;
+    size_t *weights;
+    size_t *lens;
+    size_t n;
+    size_t changes;     /* tree changes when keys were copied */
+    TTree tmp;
+};
+
+static size_t _TT_count( TTNodeConst node )
+{
+    return node ? 1 + _TT_count( node->left ) + _TT_count( node->mid ) +
+           _TT_count( node->right ) : 0;
+}
+
+static TTNode *_TT_first_link( TTree tree, unsigned char c, size_t *level )
+{
+    TTNode *link = &tree->head->mid;
+
+    *level = 0;
+
+    while( *link && ( *link )->splitter != c ) {
+        link = ( c < ( *link )->splitter ) ? &( *link )->left :
+               &( *link )->right;
+        ( *level )++;
+    }
+
+    return link;
+}
+
+/*
+ *  Internal, copy keys of branch (under the lock). Return 0 if memory
+ *  allocation fails, or 1 ('n' is 0 if branch has no keys).
+ */
+static int _TT_branch_keys( TTree tree, TTNode node,
+                            struct _TT_Branch *branch )
+{
+    TTNodeConst next;
+    TT_Cursor cursor;
+    size_t n = 0, size = 0, rlen = TT_RLEN( node );
+    char *ptr;
+    int self = ( node->flags & TN_KEY ) && !rlen;
+
+    branch->changes = tree->changes;
+    _TT_cursor_init( &cursor, node, 0, ( const char * ) &node->splitter, 1,
+                     T_NO_FLAGS );
+
+    while( TT_prefix_next( &cursor ) ) {
+        n++;
+        size += cursor.len + 1;
+    }
+
+    TT_prefix_close( &cursor );
+
+    if( cursor.error != TE_NO_ERROR ) {
+        return 0;
+    }
+
+    if( !n && !self ) {
+        return 1;
+    }
+
+    n += self;
+    size += self ? 2 : 0;
+    branch->keys = Malloc( n * ( sizeof( char * ) + sizeof( void * ) +
+                                 sizeof( size_t ) * 2 ) + size );
+
+    if( !branch->keys ) {
+        return 0;
+    }
+
+    branch->datas = ( void ** )( branch->keys + n );
+    branch->weights = ( size_t * )( branch->datas + n );
+    branch->lens = branch->weights + n;
+    ptr = ( char * )( branch->lens + n );
+    n = 0;
+
+    if( self ) {
+        branch->keys[n] = ptr;
+        branch->lens[n] = 1;
+        branch->datas[n] = node->data;
+        branch->weights[n++] = TT_weight( node );
+        *ptr++ = node->splitter;
+        *ptr++ = 0;
+    }
+
+    _TT_cursor_init( &cursor, node, 0, ( const char * ) &node->splitter, 1,
+                     T_NO_FLAGS );
+
+    while( ( next = TT_prefix_next( &cursor ) ) != NULL ) {
+        branch->keys[n] = ptr;
+        branch->lens[n] = cursor.len;
+        branch->datas[n] = next->data;
+        branch->weights[n++] = TT_weight( next );
+        memcpy( ptr, cursor.key, cursor.len + 1 );
+        ptr += cursor.len + 1;
+    }
+
+    TT_prefix_close( &cursor );
+    branch->n = n;
+    return cursor.error == TE_NO_ERROR;
+}
+
+/*
+ *  Internal, build private tree of copied keys (without the lock). Return
+ *  its first level node, or NULL if memory allocation fails.
+ */
+static TTNode _TT_branch_build( Tree_Flags flags, struct _TT_Branch *branch )
+{
+    TTNode root = NULL;
+    size_t i;
+
+    branch->tmp = TT_create( flags & ( T_COMPRESS | T_WEIGHTS | T_COUNTS |
+                                       T_ARENA ), NULL );
+
+    if( branch->tmp && _TT_build( branch->tmp, branch->keys, branch->lens,
+                                  branch->datas, 0, branch->n, 0 ) ) {
+        root = branch->tmp->head->mid;
+    }
+
+    for( i = 0; root && ( flags & T_WEIGHTS ) && i < branch->n; i++ ) {
+        if( branch->weights[i] &&
+                !_TT_reweigh( branch->tmp, branch->keys[i], branch->lens[i],
+                              _TT_search( root, branch->keys[i],
+                                          branch->lens[i], T_NO_FLAGS ),
+                              branch->weights[i] ) ) {
+            root = NULL;
+        }
+    }
+
+    return root;
+}
+
+/*
+ *  Internal, replace branch by first level node of private tree (under the
+ *  lock). Return 0 if memory allocation fails, or 1.
+ */
+static int _TT_branch_publish( TTree tree, TTNode *link, size_t level,
+                               TTree tmp )
+{
+    TTNode node = *link, root = tmp->head->mid;
+
+    if( !_TT_levels( tree, level + tmp->depth ) ) {
+        return 0;
+    }
+
+    root->left = node->left;
+    root->right = node->right;
+
+    if( tree->flags & ( T_WEIGHTS | T_COUNTS ) ) {
+        _TT_refresh( root, tree->flags );
+    }
+
+    tree->changes++;
+    _TT_stat_branch( tree, node, level, 0 );
+    TT_STORE( *link, root );
+    _TT_stat_branch( tree, root, level, 1 );
+    tree->nodes += tmp->nodes;
+    tree->nodes -= 1 + _TT_count( node->mid );
+    _TT_retire( tree, node, TT_RETIRE_BRANCH );
+    _TT_arena_merge( tree, tmp );
+    tmp->head->mid = NULL;
+    return 1;
+}
+
+/*
+ *  Internal, rebuild branch of first level node 'c'. Branch changed while
+ *  every of TT_COMPACT_TRIES private trees was built is left as is, and
+ *  '*kept' is set then. Return 0 if memory allocation fails, or 1.
+ */
+static int _TT_compact_branch( TTree tree, unsigned char c, int *kept )
+{
+    struct _TT_Branch branch;
+    size_t level;
+    int tries, rc = 1;
+
+    for( tries = 0; tries < TT_COMPACT_TRIES; tries++ ) {
+        TTNode *link, root = NULL;
+        int done = 0;
+
+        memset( &branch, 0, sizeof( struct _TT_Branch ) );
+        __lock( tree->lock );
+        link = _TT_first_link( tree, c, &level );
+
+        if( *link ) {
+            rc = _TT_branch_keys( tree, *link, &branch );
+
+            /*
+             * Nodes without keys are not rebuilt:
+             */
+            if( rc && !branch.n && ( *link )->mid ) {
+                *kept = 1;
+            }
+        }
+
+        __unlock( tree->lock );
+
+        if( rc && branch.n ) {
+            root = _TT_branch_build( tree->flags, &branch );
+            rc = root != NULL;
+        }
+
+        if( root ) {
+            __lock( tree->lock );
+
+            if( tree->changes == branch.changes ) {
+                link = _TT_first_link( tree, c, &level );
+                rc = _TT_branch_publish( tree, link, level, branch.tmp );
+                done = 1;
+            }
+
+            __unlock( tree->lock );
+        }
+
+        if( branch.tmp ) {
+            TT_destroy( branch.tmp );
+        }
+
+        Free( branch.keys );
+
+        if( !rc || !branch.n || done ) {
+            return rc;
+        }
+    }
+
+    *kept = 1;
+    return 1;
+}
+
+static size_t _TT_first_level( TTNode node, TTNode *nodes, size_t n )
+{
+    if( node ) {
+        n = _TT_first_level( node->left, nodes, n );
+        nodes[n++] = node;
+        n = _TT_first_level( node->right, nodes, n );
+    }
+
+    return n;
+}
+
+static TTNode _TT_balance( TTNode *nodes, size_t lo, size_t hi,
+                           Tree_Flags flags )
+{
+    size_t mid;
+    TTNode node;
+
+    if( lo >= hi ) {
+        return NULL;
+    }
+
+    mid = lo + ( hi - lo ) / 2;
+    node = nodes[mid];
+    node->left = _TT_balance( nodes, lo, mid, flags );
+    node->right = _TT_balance( nodes, mid + 1, hi, flags );
+
+    if( flags & ( T_WEIGHTS | T_COUNTS ) ) {
+        _TT_refresh( node, flags );
+    }
+
+    return node;
+}
+
+static int _TT_compact_root( TTree tree )
+{
+    TTNode nodes[256], copies[256];
+    size_t n, i, m = 0;
+
+    /*
+     * Levels of first level nodes change by 255 at most:
+     */
+    if( !_TT_levels( tree, _TT_depth( tree->head->mid, 0 ) + 255 ) ) {
+        return 0;
+    }
+
+    n = _TT_first_level( tree->head->mid, nodes, 0 );
+
+    for( i = 0; i < n; i++ ) {
+        TTNode node = nodes[i], copy;
+        const char *run;
+        size_t len = _TT_run( node, &run );
+
+        if( !( node->flags & TN_KEY ) && !node->mid ) {
+            continue;
+        }
+
+        copy = _TT_create_run( tree, node->splitter, run, len,
+                               _TT_static( node ) );
+
+        if( !copy ) {
+            while( m ) {
+                _TT_free( copies[--m] );
+            }
+
+            return 0;
+        }
+
+        copy->flags |= node->flags & TN_KEY;
+        copy->data = node->data;
+        copy->mid = node->mid;
+
+        if( tree->flags & T_WEIGHTS ) {
+            TT_WEIGHT( copy )->weight = TT_WEIGHT( node )->weight;
+        }
+
+        copies[m++] = copy;
+    }
+
+    tree->changes++;
+    TT_STORE( tree->head->mid, _TT_balance( copies, 0, m, tree->flags ) );
+
+    for( i = 0; i < n; i++ ) {
+        _TT_retire( tree, nodes[i], TT_RETIRE_NODE );
+    }
+
+    tree->nodes -= n - m;
+    return _TT_restat( tree );
+}
+
+int TT_compact( const TTree tree )
+{
+    struct _TT_Chunk *arena;
+    int c, rc = 1, kept = 0;
+
+    if( !tree || !tree->head ) {
+        return 0;
+    }
+
+    /*
+     * New nodes go to new arena chunks from now:
+     */
+    __lock( tree->lock );
+    arena = tree->arena;
+    tree->arena = NULL;
+    __unlock( tree->lock );
+
+    for( c = 0; c < 256 && rc; c++ ) {
+        rc = _TT_compact_branch( tree, ( unsigned char ) c, &kept );
+    }
+
+    __lock( tree->lock );
+
+    if( rc ) {
+        rc = _TT_compact_root( tree );
+    }
+
+    if( rc && !kept ) {
+        _TT_retire( tree, arena, TT_RETIRE_ARENA );
+    }
+    else {
+        _TT_arena_link( tree, arena );
+    }
+
+    if( tree->epoch ) {
+        _TT_advance( tree, 1 );
+    }
+
+    __unlock( tree->lock );
+    return rc;
+}
+
+/*
+ *  Parallel build stuff. Keys are partitioned by (folded) first byte, every
+ *  partition is built by worker thread in private tree, and its single first
+ *  level node is linked under tree head at the end. Partitions which already
+ *  have first level node in tree are inserted by calling thread.
+ *
+ *  Partition bigger than its share of keys is split: bytes shared by all its
+ *  keys become run node (or chain of nodes) made by calling thread, and keys
+ *  are partitioned again by next byte into parts built from that byte on.
+ *  So keys with long common prefixes (URLs, paths) are built by all threads
+ *  too. Keys of split partition of T_NOCASE tree are folded first (folded
+ *  key suffix may differ from suffix of folded key).
+ */
+#ifndef TT_SPLIT_MIN
+# define TT_SPLIT_MIN 1024
+#endif
+
+struct _TT_Part {
+    const char **keys;
+    void **datas;
+    size_t n;
+    size_t off;         /* bytes before part, shared by all its keys */
+    size_t len;         /* split part: end of bytes shared by all keys */
+    size_t exact;       /* split part: keys ending at 'len', first in keys */
+    size_t first;       /* split part: children parts */
+    size_t count;
+    int caller;         /* part is inserted into tree by calling thread */
+    int folded;
+    char *blob;         /* folded keys */
+    TTree tmp;          /* part built by worker */
+    TTNode root;        /* first level node of part (in its parent) */
+    TTNode tail;        /* split part: node of last shared byte */
+};
+
+struct _TT_Parts {
+    struct _TT_Part *part;
+    size_t count;
+    size_t size;
+};
+
+struct _TT_Builder {
+    struct _TT_Part **order;
+    size_t count;
+    size_t next;
+    int error;
+};
+
+static unsigned char _TT_lead( const char *key, Tree_Flags flags )
+{
+    char lead[2];
+
+    if( !( flags & T_NOCASE ) ) {
+        return ( unsigned char ) * key;
+    }
+
+    T_Fold( lead, key, key[1] ? 2 : 1 );
+    return ( unsigned char ) lead[0];
+}
+
+static void *_TT_builder( void *arg )
+{
+    struct _TT_Builder *builder = arg;
+    size_t i;
 
-    if( node ) {
-        __lock( tree->lock );
+    while( ( i = __atomic_fetch_add( &builder->next, 1,
+                                     __ATOMIC_RELAXED ) ) < builder->count ) {
+        struct _TT_Part *part = builder->order[i];
 
-        if( node->data && tree->destructor ) {
-            tree->destructor( node->data );
+        if( !_TT_build( part->tmp, part->keys, NULL, part->datas, 0, part->n,
+                        1 ) ) {
+            __atomic_store_n( &builder->error, 1, __ATOMIC_RELAXED );
         }
-
-        node->data = NULL;
-        Free( node->key );
-        tree->keys--;
-        node->key = NULL;
-        __unlock( tree->lock );
-        return 1;
     }
 
-    return 0;
+    return NULL;
 }
 
-TTNodeConst TT_search( const TTree tree, const char *s )
+/*
+ *  Internal, add part. Return its index, or ( size_t ) -1 if memory
+ *  allocation fails.
+ */
+static size_t _TT_part_add( struct _TT_Parts *parts, const char **keys,
+                            void **datas, size_t n, size_t off )
 {
-    TTNode node;
+    struct _TT_Part *part;
 
-    if( !tree || !tree->head || !s || !*s ) {
-        return NULL;
+    if( parts->count == parts->size ) {
+        size_t size = parts->size ? parts->size * 2 : 256;
+        part = Realloc( parts->part, size * sizeof( struct _TT_Part ) );
+
+        if( !part ) {
+            return ( size_t ) - 1;
+        }
+
+        parts->part = part;
+        parts->size = size;
     }
 
-    __lock( tree->lock );
-    node = _TT_search( tree->head->mid, s, tree->flags );
-    __unlock( tree->lock );
-    return node;
+    part = &parts->part[parts->count];
+    memset( part, 0, sizeof( struct _TT_Part ) );
+    part->keys = keys;
+    part->datas = datas;
+    part->n = n;
+    part->off = off;
+    return parts->count++;
 }
 
 /*
- *  Insert nodes stuff:
+ *  Internal, replace keys of part with folded copies. Return 0 if memory
+ *  allocation fails.
  */
-static TTNode _TT_insert( TTNode node, const char *s, size_t pos, void *data,
-                          TTree tree, size_t depth )
+static int _TT_part_fold( struct _TT_Part *part )
 {
-    char c;
+    size_t i, size = 0;
+    char *ptr;
 
-    if( !tree || !tree->head || !s || !*s ) {
-        return NULL;
+    for( i = 0; i < part->n; i++ ) {
+        size += strlen( part->keys[i] ) + 1;
     }
 
-    c = ( tree->flags & T_NOCASE ) ? tolower( s[pos] ) : s[pos];
-
-    if( !node ) {
-        node = _TT_create_node( c );
-
-        if( !node ) {
-            return NULL;
-        }
+    ptr = part->blob = Malloc( size );
 
-        node->depth = depth;
-        tree->nodes++;
-        /*if( tree->depth < depth ) tree->depth = depth;*/
+    if( !ptr ) {
+        return 0;
     }
-    else if( !node->splitter && !node->key ) {
-        memset( node, 0, sizeof( struct _TTNode ) );
-        node->splitter = c;
-        node->depth = depth;
-        /*if( tree->depth < depth ) tree->depth = depth;*/
+
+    for( i = 0; i < part->n; i++ ) {
+        size_t len = strlen( part->keys[i] );
+        T_Fold( ptr, part->keys[i], len );
+        ptr[len] = 0;
+        part->keys[i] = ptr;
+        ptr += len + 1;
     }
 
-    if( c < node->splitter ) node->left = _TT_insert( node->left, s, pos, data,
-                                              tree, depth + 1 );
+    part->folded = 1;
+    return 1;
+}
+
+/*
+ *  Internal, split part: find bytes shared by all its keys, put keys ending
+ *  there first, and partition the rest (stable) by next byte into new
+ *  parts. Arrays 'keys' and 'datas' are scratch space. Return 0 if memory
+ *  allocation fails.
+ */
+static int _TT_part_split( struct _TT_Parts *parts, size_t idx,
+                           const char **keys, void **datas )
+{
+    struct _TT_Part part = parts->part[idx];
+    size_t counts[257], len = part.off + 1, i;
+    int c;
+
+    while( part.keys[0][len] ) {
+        i = 1;
 
-    if( c == node->splitter ) {
-        if( *( s + pos + 1 ) > 0 ) {
-            node->mid = _TT_insert( node->mid, s, pos + 1, data, tree,
-                                    depth + 1 );
+        while( i < part.n && part.keys[i][len] == part.keys[0][len] ) {
+            i++;
         }
-        else {
-            if( !node->key ) {
-                node->key = Strdup( s );
 
-                if( !node->key ) {
-                    return NULL;
-                }
+        if( i < part.n ) {
+            break;
+        }
 
-                tree->keys++;
-            }
+        len++;
+    }
 
-            if( tree->flags & T_INSERT_REPLACE ) {
-                if( node->data && tree->destructor ) tree->destructor(
-                        node->data );
+    memset( counts, 0, sizeof( counts ) );
 
-                node->data = data;
-            }
+    for( i = 0; i < part.n; i++ ) {
+        counts[( unsigned char ) part.keys[i][len] + 1]++;
+    }
 
-            /*
-             * do not free data
-             */
-        }
+    for( c = 1; c <= 256; c++ ) {
+        counts[c] += counts[c - 1];
     }
 
-    if( c > node->splitter ) node->right = _TT_insert( node->right, s, pos,
-                                               data, tree, depth + 1 );
+    for( i = 0; i < part.n; i++ ) {
+        size_t pos = counts[( unsigned char ) part.keys[i][len]]++;
+        keys[pos] = part.keys[i];
+        datas[pos] = part.datas[i];
+    }
 
-    return node;
-}
-TTNodeConst TT_insert( const TTree tree, const char *s, void *data )
-{
-    TTNode node;
+    memcpy( part.keys, keys, part.n * sizeof( char * ) );
+    memcpy( part.datas, datas, part.n * sizeof( void * ) );
+    parts->part[idx].len = len;
+    parts->part[idx].exact = counts[0];
+    parts->part[idx].first = parts->count;
 
-    if( !tree || !tree->head || !s || !*s ) {
-        return NULL;
-    }
+    for( c = 1; c < 256; c++ ) {
+        size_t lo = counts[c - 1], hi = counts[c], child;
 
-    __lock( tree->lock );
-    tree->head->mid = _TT_insert( tree->head->mid, s, 0, data, tree, 1 );
+        if( lo == hi ) {
+            continue;
+        }
 
-    if( !tree->head->mid ) {
-        __unlock( tree->lock );
-        return NULL;
+        child = _TT_part_add( parts, part.keys + lo, part.datas + lo, hi - lo,
+                              len );
+
+        if( child == ( size_t ) - 1 ) {
+            return 0;
+        }
+
+        parts->part[child].folded = part.folded;
+        parts->part[idx].count++;
     }
 
-    node = ( tree->flags & T_INSERT_FAST ) ?
-           tree->head : _TT_search( tree->head->mid, s, tree->flags );
-    __unlock( tree->lock );
-    return node;
+    return 1;
 }
 
 /*
- *  Tree walking stuff:
+ *  Internal, make nodes of bytes shared by keys of split part: run node, or
+ *  chain of nodes linked by 'mid'. Return 0 if memory allocation fails.
  */
-static void _TT_walk( TTNodeConst node, TT_Walk walker, void *data )
+static int _TT_part_nodes( TTree tree, struct _TT_Part *part )
 {
-    if( node ) {
-        _TT_walk( node->left, walker, data );
-        _TT_walk( node->mid, walker, data );
-        _TT_walk( node->right, walker, data );
-        walker( node, data );
+    const char *key = part->keys[0];
+    size_t i;
+
+    if( tree->flags & T_COMPRESS ) {
+        part->root = _TT_create_run( tree, key[part->off], key + part->off + 1,
+                                     part->len - part->off - 1, 0 );
+        part->tail = part->root;
+        return part->root != NULL;
     }
-}
-void _TT_walk_asc( TTNodeConst node, TT_Walk walker, void *data )
-{
-    if( node ) {
-        //        walker( node, data );
-        _TT_walk_asc( node->left, walker, data );
-        walker( node, data );
-        _TT_walk_asc( node->mid, walker, data );
-        _TT_walk_asc( node->right, walker, data );
+
+    for( i = part->off; i < part->len; i++ ) {
+        TTNode node = _TT_create_node( tree, key[i] );
+
+        if( !node ) {
+            return 0;
+        }
+
+        if( part->tail ) {
+            part->tail->mid = node;
+        }
+        else {
+            part->root = node;
+        }
+
+        part->tail = node;
     }
+
+    return 1;
 }
-static void _TT_walk_desc( TTNodeConst node, TT_Walk walker, void *data )
+static void _TT_part_free( struct _TT_Part *part )
 {
-    if( node ) {
-        _TT_walk_desc( node->right, walker, data );
-        _TT_walk_desc( node->mid, walker, data );
-        walker( node, data );
-        _TT_walk_desc( node->left, walker, data );
-        //        walker( node, data );
+    TTNode node = part->root;
+
+    while( node ) {
+        TTNode next = ( node != part->tail ) ? node->mid : NULL;
+        _TT_free( node );
+        node = next;
     }
+
+    part->root = part->tail = NULL;
 }
-void TT_walk( const TTree tree, TT_Walk walker, void *data )
+
+static void _TT_chain_refresh( TTNode node, TTNode tail, Tree_Flags flags )
 {
-    if( tree ) {
-        __lock( tree->lock );
-        _TT_walk( tree->head, walker, data );
-        __unlock( tree->lock );
+    if( node != tail ) {
+        _TT_chain_refresh( node->mid, tail, flags );
     }
+
+    _TT_refresh( node, flags );
 }
-void TT_walk_asc( const TTree tree, TT_Walk walker, void *data )
+
+/*
+ *  Internal, link first level nodes of children parts under shared bytes
+ *  of split part, and mark key of keys ending there (first data wins, or
+ *  the last one in T_INSERT_REPLACE tree, as inserts do). Return number of
+ *  new nodes.
+ */
+static size_t _TT_part_link( TTree tree, struct _TT_Parts *parts, size_t idx )
 {
-    if( tree ) {
-        __lock( tree->lock );
-        _TT_walk_asc( tree->head, walker, data );
-        __unlock( tree->lock );
+    struct _TT_Part *part = &parts->part[idx];
+    TTNode roots[256];
+    size_t i;
+
+    for( i = 0; i < part->count; i++ ) {
+        roots[i] = parts->part[part->first + i].root;
     }
-}
-void TT_walk_desc( const TTree tree, TT_Walk walker, void *data )
-{
-    if( tree ) {
-        __lock( tree->lock );
-        _TT_walk_desc( tree->head, walker, data );
-        __unlock( tree->lock );
+
+    part->tail->mid = _TT_balance( roots, 0, part->count, tree->flags );
+
+    for( i = 0; i < part->exact; i++ ) {
+        if( !( part->tail->flags & TN_KEY ) ) {
+            part->tail->flags |= TN_KEY;
+            part->tail->data = part->datas[i];
+        }
+        else if( tree->flags & T_INSERT_REPLACE ) {
+            _TT_retire( tree, part->tail->data, TT_RETIRE_DATA );
+            part->tail->data = part->datas[i];
+        }
     }
+
+    _TT_chain_refresh( part->root, part->tail, tree->flags );
+    return ( tree->flags & T_COMPRESS ) ? 1 : part->len - part->off;
 }
 
 /*
- *  Tree information stuff, get depth:
+ *  Internal, link first level node of private tree as leaf of first level
+ *  splitter tree:
  */
-static void _TT_depth( TTNodeConst node, void *data )
-{
-    if( node->depth > *( size_t * )data ) {
-        ( *( size_t * )data ) = node->depth;
-    }
-}
-size_t TT_depth( const TTree tree )
+static void _TT_graft( TTree tree, TTNode root )
 {
-    size_t max = 0;
+    TTNode *links[256];
+    TTNode *link = &tree->head->mid;
+    size_t depth = 0;
 
-    if( tree ) {
-        TT_walk( tree, _TT_depth, &max );
+    while( *link ) {
+        links[depth++] = link;
+        link = ( root->splitter < ( *link )->splitter ) ? &( *link )->left :
+               &( *link )->right;
     }
 
-    return max;
+    TT_STORE( *link, root );
+
+    while( ( tree->flags & ( T_WEIGHTS | T_COUNTS ) ) && depth-- ) {
+        _TT_refresh( *links[depth], tree->flags );
+    }
 }
 
 /*
- *  Get sorted data from tree:
+ *  Internal, unlink grafted nodes (they are leaves of first level splitter
+ *  tree, or are linked under other grafted nodes), and refresh the rest:
  */
-static void _TT_data( TTNodeConst node, void *data )
+static void _TT_ungraft( TTree tree, TTNode *link, TTNode *grafted,
+                         size_t n )
 {
-    if( node->key ) {
-        struct {
-            size_t max;
-            size_t idx;
-            TT_Data data;
-        }*ptr = data;
+    TTNode node = *link;
+    size_t i;
+
+    if( !node ) {
+        return;
+    }
 
-        if( ptr->idx < ptr->max ) {
-            ptr->data[ptr->idx].key = node->key;
-            ptr->data[ptr->idx].data = node->data;
-            ptr->idx++;
+    for( i = 0; i < n; i++ ) {
+        if( node == grafted[i] ) {
+            TT_STORE( *link, NULL );
+            return;
         }
     }
+
+    _TT_ungraft( tree, &node->left, grafted, n );
+    _TT_ungraft( tree, &node->right, grafted, n );
+    _TT_refresh( node, tree->flags );
 }
 
-TT_DataConst TT_data( const TTree tree, size_t *count )
+static int _TT_part_cmp( const void *a, const void *b )
 {
-    struct {
-        size_t max;
-        size_t idx;
-        TT_Data data;
-    } data =
-    { 0 };
+    size_t na = ( *( struct _TT_Part * const * ) a )->n;
+    size_t nb = ( *( struct _TT_Part * const * ) b )->n;
+    return ( na < nb ) - ( na > nb );
+}
 
-    if( count ) {
-        *count = 0;
+int TT_build_parallel( const TTree tree, const char **keys, void **datas,
+                       size_t n, size_t nthreads )
+{
+    struct _TT_Parts parts;
+    struct _TT_Builder builder;
+    TTNode grafted[256];
+    size_t offsets[257], i, j, limit, budget = 4 * n, ngrafted = 0;
+    size_t nodes = 0, nkeys = 0;
+    const char **sorted, **skeys;
+    void **sdatas, **scratch;
+    pthread_t *threads;
+    unsigned char *leads;
+    int c, rc = 1, linked = 0;
+
+    if( !tree || !tree->head || !keys ) {
+        return 0;
     }
 
-    if( !tree ) {
-        return NULL;
+    if( !nthreads ) {
+        long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+        nthreads = cpus > 0 ? ( size_t ) cpus : 1;
     }
 
-    data.data = Calloc( sizeof( struct _TT_Data ), tree->keys + 1 );
+    sorted = Malloc( n * ( 2 * sizeof( char * ) + 2 * sizeof( void * ) + 1 ) +
+                     1 );
 
-    if( !data.data ) {
-        return NULL;
+    if( !sorted ) {
+        return 0;
     }
 
-    data.max = ( ( size_t ) - 1 );
-    TT_walk_asc( tree, _TT_data, &data );
+    skeys = sorted + n;
+    sdatas = ( void ** )( skeys + n );
+    scratch = sdatas + n;
+    leads = ( unsigned char * )( scratch + n );
+    memset( offsets, 0, sizeof( offsets ) );
+    memset( &parts, 0, sizeof( parts ) );
+    memset( &builder, 0, sizeof( builder ) );
+    limit = nthreads > 1 ? n / ( nthreads * 4 ) : ( size_t ) - 1;
 
-    if( count ) {
-        *count = data.idx;
+    if( limit < TT_SPLIT_MIN ) {
+        limit = TT_SPLIT_MIN;
     }
 
-    return data.data;
-}
-
-void _TS_data( TTNodeConst node, void *data )
-{
-    if( node->key ) {
-        struct {
-            size_t max;
-            size_t idx;
-            char **data;
-        }*ptr = data;
+    for( i = 0; i < n; i++ ) {
+        leads[i] = ( keys[i] && *keys[i] ) ? _TT_lead( keys[i], tree->flags ) :
+                   0;
 
-        if( ptr->idx < ptr->max ) {
-            ptr->data[ptr->idx] = node->key;
-            ptr->idx++;
+        if( leads[i] ) {
+            offsets[leads[i] + 1]++;
         }
     }
-}
-char **TS_data( const TTree tree, size_t *count )
-{
-    struct {
-        size_t max;
-        size_t idx;
-        char **data;
-    } data =
-    { 0 };
-
-    if( count ) {
-        *count = 0;
-    }
 
-    if( !tree ) {
-        return NULL;
+    for( c = 1; c <= 256; c++ ) {
+        offsets[c] += offsets[c - 1];
     }
 
-    data.data = Calloc( sizeof( char * ), tree->keys + 1 );
-
-    if( !data.data ) {
-        return NULL;
+    /*
+     * Stable partition, so sorted input stays sorted in every part:
+     */
+    for( i = 0; i < n; i++ ) {
+        if( leads[i] ) {
+            size_t pos = offsets[leads[i]]++;
+            sorted[pos] = keys[i];
+            sdatas[pos] = datas ? datas[i] : NULL;
+        }
     }
 
-    data.max = ( ( size_t ) - 1 );
-    TT_walk_asc( tree, _TS_data, &data );
+    __lock( tree->lock );
 
-    if( count ) {
-        *count = data.idx;
-    }
+    for( c = 1; c < 256 && rc; c++ ) {
+        size_t lo = offsets[c - 1], hi = offsets[c];
+        TTNode node = tree->head->mid;
 
-    return data.data;
-}
+        if( lo == hi ) {
+            continue;
+        }
 
-/*
- *  Dump tree stuff:
- */
-static void _TT_dump( const TTNode node, Tree_DataDump dumper, char *indent,
-                      int last,
-                      FILE *handle )
-{
-    size_t strip = 0;
+        while( node && node->splitter != c ) {
+            node = ( c < node->splitter ) ? node->left : node->right;
+        }
 
-    if( node->splitter ) {
-        strip = T_Indent( indent, last, handle );
+        i = _TT_part_add( &parts, sorted + lo, sdatas + lo, hi - lo, 0 );
 
-        if( node->key ) {
-            fprintf( handle, "%c => [%s]",
-                     ( isprint( node->splitter ) ? node->splitter : '?' ),
-                     node->key );
+        if( i == ( size_t ) - 1 ) {
+            rc = 0;
         }
         else {
-            fprintf( handle, "%c => ()",
-                     ( isprint( node->splitter ) ? node->splitter : '?' ) );
+            parts.part[i].caller = node != NULL;
         }
+    }
 
-        if( dumper ) {
-            dumper( node->data, handle );
+    /*
+     * Big new parts are split breadth-first, while number of keys scanned
+     * fits the budget:
+     */
+    for( i = 0; rc && i < parts.count; i++ ) {
+        struct _TT_Part *part = &parts.part[i];
+
+        if( part->caller || part->n <= limit || part->n > budget ) {
+            continue;
         }
 
-        fprintf( handle, "\n" );
+        budget -= part->n;
+
+        if( ( ( tree->flags & T_NOCASE ) && !part->folded &&
+                !_TT_part_fold( part ) ) ||
+                !_TT_part_split( &parts, i, skeys, scratch ) ) {
+            rc = 0;
+        }
     }
 
-    if( node->left ) _TT_dump( node->left, dumper, indent,
-                                   ( node->right || node->mid ) ? 0 : 1, handle );
+    builder.order = rc ? Malloc( parts.count * sizeof( struct _TT_Part * ) +
+                                 1 ) : NULL;
+    rc = builder.order != NULL;
 
-    if( node->mid ) _TT_dump( node->mid, dumper, indent, node->right ? 0 : 1,
-                                  handle );
+    /*
+     * Shared bytes nodes are made by calling thread, private trees of the
+     * rest get own arenas:
+     */
+    for( i = 0; rc && i < parts.count; i++ ) {
+        struct _TT_Part *part = &parts.part[i];
 
-    if( node->right ) {
-        _TT_dump( node->right, dumper, indent, 1, handle );
-    }
+        if( part->len ) {
+            rc = _TT_part_nodes( tree, part );
+        }
+        else if( !part->caller ) {
+            Tree_Flags flags = ( tree->flags & ~T_CONCURRENT ) | T_ARENA;
 
-    if( strip ) {
-        indent[strip] = 0;
-    }
-}
+            if( part->folded ) {
+                flags &= ~( T_NOCASE | T_STATIC_KEYS );
+            }
 
-int TT_dump( TTree tree, Tree_DataDump dumper, FILE *handle )
-{
-    size_t depth = TT_depth( tree );
-    char *buf = Calloc( depth + 1, 2 );
+            for( j = 0; j < part->n; j++ ) {
+                part->keys[j] += part->off;
+            }
 
-    if( buf ) {
-        fprintf( handle, "nodes: %zu, keys: %zu, depth: %zu\n",
-                 tree->nodes/*TT_nodes( tree )*/, tree->keys/*TT_keys( tree )*/,
-                 TT_depth( tree ) );
-        __lock( tree->lock );
-        _TT_dump( tree->head, dumper, buf, 0, handle );
-        __unlock( tree->lock );
-        Free( buf );
-        return 1;
+            part->tmp = TT_create( flags, tree->destructor );
+            rc = part->tmp != NULL;
+            builder.order[builder.count++] = part;
+        }
     }
 
-    return 0;
-}
-
-/*
- *  Lookup stuff:
- */
-TTNode __TT_lookup( TTNode node, const char *s, Tree_Flags flags )
-{
-    TTNode ptr = node;
+    if( rc ) {
+        size_t started = 0;
 
-    while( *s && ( ptr && ptr->splitter ) ) {
-        char c = ( flags & T_NOCASE ) ? tolower( *s ) : *s;
+        qsort( builder.order, builder.count, sizeof( struct _TT_Part * ),
+               _TT_part_cmp );
 
-        if( c < ptr->splitter ) {
-            ptr = ptr->left;
-        }
-        else if( c > ptr->splitter ) {
-            ptr = ptr->right;
+        if( nthreads > builder.count ) {
+            nthreads = builder.count;
         }
-        else {
-            s++;
 
-            if( *s ) {
-                ptr = ptr->mid;
-            }
+        threads = nthreads > 1 ? Malloc( sizeof( pthread_t ) * nthreads ) :
+                  NULL;
+
+        while( threads && started < nthreads - 1 &&
+                !pthread_create( &threads[started], NULL, _TT_builder,
+                                 &builder ) ) {
+            started++;
         }
-    }
 
-    return ptr;
-}
+        _TT_builder( &builder );
 
-TT_Data _TT_lookup( TTree tree, const char *prefix, size_t max,
-                    size_t *count )
-{
-    TTNode node;
-    struct {
-        size_t max;
-        size_t idx;
-        TT_Data data;
-    } data =
-    { 0 };
+        while( started ) {
+            pthread_join( threads[--started], NULL );
+        }
 
-    if( count ) {
-        *count = 0;
+        Free( threads );
+        rc = !builder.error;
     }
 
-    if( !tree || !prefix || !*prefix ) {
-        return NULL;
+    for( i = 0; rc && i < parts.count; i++ ) {
+        if( parts.part[i].caller ) {
+            rc = _TT_build( tree, parts.part[i].keys, NULL,
+                            parts.part[i].datas, 0, parts.part[i].n, 1 );
+        }
     }
 
-    node = __TT_lookup( tree->head->mid, prefix, tree->flags );
+    /*
+     * Children parts follow their parent, so parts are linked backwards.
+     * Grafted branches are counted by _TT_compact_root():
+     */
+    if( rc ) {
+        for( i = parts.count; i--; ) {
+            struct _TT_Part *part = &parts.part[i];
 
-    if( !node || !node->mid ) {
-        return NULL;
-    }
+            if( part->tmp ) {
+                part->root = part->tmp->head->mid;
+                nodes += part->tmp->nodes;
+                nkeys += part->tmp->keys;
+            }
+            else if( part->len ) {
+                nodes += _TT_part_link( tree, &parts, i );
+                nkeys += part->exact ? 1 : 0;
+            }
 
-    if( !max ) {
-        max = tree->keys/*TT_keys( tree )*/;
-    }
+            if( !part->off && !part->caller ) {
+                grafted[ngrafted++] = part->root;
+            }
+        }
 
-    data.data = Calloc( sizeof( struct _TT_Data ), max + 1 );
+        linked = 1;
+        tree->changes++;
 
-    if( !data.data ) {
-        return NULL;
-    }
+        for( i = 0; i < ngrafted; i++ ) {
+            _TT_graft( tree, grafted[i] );
+        }
 
-    data.max = max;
-    _TT_walk_asc( node->mid, _TT_data, &data );
+        tree->nodes += nodes;
+        tree->keys += nkeys;
 
-    if( count ) {
-        *count = data.idx;
+        if( ngrafted && !_TT_compact_root( tree ) ) {
+            _TT_ungraft( tree, &tree->head->mid, grafted, ngrafted );
+
+            for( i = 0; i < ngrafted; i++ ) {
+                _TT_retire( tree, grafted[i], TT_RETIRE_BRANCH );
+            }
+
+            tree->nodes -= nodes;
+            tree->keys -= nkeys;
+            rc = 0;
+        }
     }
 
-    return data.data;
-}
+    /*
+     * Arenas of private trees are moved to tree, or retired after nodes
+     * using them:
+     */
+    for( i = 0; i < parts.count; i++ ) {
+        struct _TT_Part *part = &parts.part[i];
 
-TTree TT_lookup_tree( TTree tree, const char *prefix )
-{
-    TTree rc = TT_create( tree->flags, NULL );
-    TT_Data data, ptr;
+        if( part->tmp ) {
+            if( rc ) {
+                _TT_arena_merge( tree, part->tmp );
+            }
+            else {
+                part->tmp->destructor = NULL;
+                _TT_retire( tree, part->tmp->arena, TT_RETIRE_ARENA );
+                part->tmp->arena = NULL;
+            }
 
-    if( !rc ) {
-        return NULL;
-    }
+            part->tmp->head->mid = NULL;
+            TT_destroy( part->tmp );
+        }
+        else if( !linked ) {
+            _TT_part_free( part );
+        }
 
-    __lock( tree->lock );
-    data = _TT_lookup( tree, prefix, 0, NULL );
-    ptr = data;
+        Free( part->blob );
+    }
 
-    while( ptr && ptr->key ) {
-        rc->head->mid = _TT_insert( rc->head->mid, ptr->key, 0, ptr->data, rc,
-                                    1 );
-        ptr++;
+    if( tree->epoch ) {
+        _TT_advance( tree, 1 );
     }
 
     __unlock( tree->lock );
-    Free( data );
+    Free( parts.part );
+    Free( builder.order );
+    Free( sorted );
     return rc;
 }
-
@@ -18,15 +18,28 @@ extern "C"
 typedef struct _TT_Data {
     char *key;
     void *data;
+    size_t len;     /* key length (binary keys may have zero bytes) */
 } *TT_Data;
 
 typedef struct _TT_Data const *TT_DataConst;
 
+/*
+ *  Node flags:
+ */
+#define TN_KEY  1   /* node terminates a key */
+#define TN_RUN  2   /* node has bytes run (T_COMPRESS trees) */
+#define TN_WEIGHT 4 /* node has weights (T_WEIGHTS trees) */
+#define TN_ARENA 8  /* node is allocated from arena (T_ARENA trees) */
+#define TN_COUNT 16 /* node has keys counter (T_COUNTS trees) */
+
+/*
+ *  Nodes do not store keys, keys are rebuilt from path on demand (walking
+ *  with TT_walk_keys(), TT_data(), lookups).
+ */
 typedef struct _TTNode {
-    char splitter;
-    char *key;
+    unsigned char splitter;
+    unsigned char flags;
     void *data;
-    size_t depth;
     struct _TTNode *left;
     struct _TTNode *mid;
     struct _TTNode *right;
@@ -35,19 +48,92 @@ typedef struct _TTNode {
 typedef struct _TTNode const *TTNodeConst;
 
 typedef void ( *TT_Walk )( TTNodeConst node, void *data );
+/*
+ *  Key walker. Key is rebuilt from path and valid only during call. Return
+ *  non-zero to stop walking.
+ */
+typedef int ( *TT_KeyWalk )( const char *key, size_t len, TTNodeConst node,
+                             void *data );
+
+/*
+ *  Readers state and retired memory of T_CONCURRENT tree, and nodes memory
+ *  of T_ARENA tree, see ttree.c.
+ */
+struct _TT_Epoch;
+struct _TT_Chunk;
 
 typedef struct _TernaryTree {
     Tree_Flags flags;
     Tree_Destroy destructor;
     size_t keys;
     size_t nodes;
+    size_t changes;
     size_t depth;
+    size_t paths;
+    size_t levels;
+    size_t *histogram;
     TTNode head;
+    struct _TT_Epoch *epoch;
+    struct _TT_Chunk *arena;
     __lock_t( lock );
 } *TTree;
 
 /*
- *  Create and destroy tree:
+ *  Prefix cursor, yields matched keys one by one without allocations (stack
+ *  and key spill to heap only if TT_CURSOR_DEPTH or TT_CURSOR_KEY is too
+ *  small). Cursor must not be copied, and tree must not be modified while
+ *  cursor is used.
+ */
+#ifndef TT_CURSOR_DEPTH
+# define TT_CURSOR_DEPTH 64
+#endif
+#ifndef TT_CURSOR_KEY
+# define TT_CURSOR_KEY 256
+#endif
+
+struct _TT_Frame {
+    TTNodeConst node;
+    size_t len;
+    int state;
+};
+
+typedef struct _TT_Cursor {
+    char *key;
+    size_t len;
+    Tree_Error error;
+    TTNodeConst self;
+    size_t depth;
+    size_t size;
+    size_t ksize;
+    struct _TT_Frame *stack;
+    struct _TT_Frame frames[TT_CURSOR_DEPTH];
+    char buf[TT_CURSOR_KEY];
+} TT_Cursor;
+
+/*
+ *  Tree statistics, see TT_stats().
+ */
+typedef struct _TT_Stats {
+    size_t keys;
+    size_t nodes;
+    size_t depth;       /* longest search path */
+    size_t paths;       /* sum of keys search paths */
+    double average;     /* average search path of key */
+} TT_Stats;
+
+/*
+ *  Prefix view (namespace) of tree, see TT_view().
+ */
+typedef struct _TT_View {
+    TTree tree;
+    size_t len;
+    char *prefix;
+} *TT_View;
+
+/*
+ *  Create and destroy tree. Nodes of T_ARENA tree are released in bulk by
+ *  TT_clear(), TT_destroy() and TT_compact(), deleted keys do not give
+ *  memory back before.
  */
 TTree TT_create( Tree_Flags flags, Tree_Destroy destructor );
 void TT_clear( TTree tree );
@@ -56,14 +142,80 @@ void TT_destroy( TTree tree );
 /*
  *  Insert key / data pair. Data may be NULL. On succcess return inserted
  *  node pointer if TT_FAST_INSERT flag is NOT set or tree head pointer. If
- *  TT_INSERT_IGNORE flag is NOT set existing data will be destroyed and
- *  replaced. Return NULL if operation fails.
+ *  T_INSERT_REPLACE flag is set existing data will be destroyed and
+ *  replaced. Return NULL if operation fails. Key is walked once, without
+ *  recursion.
  */
 TTNodeConst TT_insert( const TTree tree, const char *key, void *data );
+/*
+ *  Binary keys: same as TT_insert(), TT_search(), TT_del_key(), TT_lookup()
+ *  and TT_nlookup(), but key is 'len' bytes which may include zeros (bytes
+ *  are compared as unsigned). Use 'len' field of TT_Data and key walkers
+ *  'len' argument to get lengths of such keys back. T_NOCASE folds binary
+ *  keys as text too, so such trees should be created without it.
+ */
+TTNodeConst TT_insert_n( const TTree tree, const void *key, size_t len,
+                         void *data );
+TTNodeConst TT_search_n( const TTree tree, const void *key, size_t len );
+int TT_del_key_n( const TTree tree, const void *key, size_t len );
+TT_DataConst TT_lookup_n( const TTree tree, const void *prefix, size_t len,
+                          size_t *count );
+TT_DataConst TT_nlookup_n( const TTree tree, const void *prefix, size_t len,
+                           size_t max, size_t *count );
+/*
+ *  Insert key / data pair with weight, or set weight of existing key (data
+ *  is handled as in TT_insert()). Tree must be created with T_WEIGHTS flag,
+ *  TT_insert() gives zero weight to new keys. TT_weight() returns weight of
+ *  key node.
+ */
+TTNodeConst TT_insert_weight( const TTree tree, const char *key, void *data,
+                              size_t weight );
+size_t TT_weight( TTNodeConst node );
+/*
+ *  Insert n keys (with data from 'datas', if not NULL) sorted in ascending
+ *  order. Keys are inserted medians first, so every splitter tree stays near
+ *  log height (unsorted keys are inserted too, but without this guarantee).
+ *  Return 0 if operation fails, or 1.
+ */
+int TT_build( const TTree tree, const char **keys, void **datas, size_t n );
+/*
+ *  Same as TT_build(), but keys are partitioned by first byte and new first
+ *  level branches are built in private trees by 'nthreads' threads (0 means
+ *  number of CPUs), then linked under tree head. Big partitions are split
+ *  again by bytes following prefix shared by their keys, so keys with common
+ *  prefix are built by all threads too. Keys with first byte already present
+ *  in tree are inserted by calling thread. Nodes of private trees come from
+ *  their arenas, which are moved to tree: as in T_ARENA tree, this memory is
+ *  returned by TT_clear(), TT_destroy() and TT_compact() only. The lock is
+ *  held all the time. Return 0 if operation fails (new branches are not
+ *  linked then), or 1.
+ */
+int TT_build_parallel( const TTree tree, const char **keys, void **datas,
+                       size_t n, size_t nthreads );
+/*
+ *  Read sections of T_CONCURRENT tree. TT_search(), TT_longest_prefix() and
+ *  lookups do not take the lock in such trees, returned node (and its data)
+ *  stays valid until it is deleted or replaced. Wrap calls and use of their
+ *  results with TT_read_begin() / TT_read_end() to keep it valid longer.
+ *  Writers do not wait for readers: memory they unlink is freed by later
+ *  writes, when readers which could see it are gone (or by TT_destroy()).
+ *  So thread may modify tree inside its read section, but must not destroy
+ *  it there (writer waits for readers only if memory allocation fails).
+ *  For other trees both functions do nothing.
+ */
+int TT_read_begin( const TTree tree );
+void TT_read_end( const TTree tree, int token );
 /*
  *  Search tree node with specified key. Return found node pointer or NULL.
  */
 TTNodeConst TT_search( const TTree tree, const char *key );
+/*
+ *  Search node with longest key which is prefix of input (input need not
+ *  end at key boundary). Set *len to key length if 'len' is not NULL.
+ *  Return found node pointer or NULL.
+ */
+TTNodeConst TT_longest_prefix( const TTree tree, const char *input,
+                               size_t *len );
 /*
  *  Lookup nodes with key started by prefix. Return pointer to allocated
  *  TT_Data array wich must freed by free() or NULL. Last element of
@@ -73,24 +225,105 @@ TTNodeConst TT_search( const TTree tree, const char *key );
 TT_DataConst TT_lookup( const TTree tree, const char *prefix, size_t *count );
 TT_DataConst TT_nlookup( const TTree tree, const char *prefix, size_t max,
                          size_t *count );
+/*
+ *  Start prefix cursor (NULL or empty prefix means all keys). Return 0 if
+ *  nothing is matched, or 1. TT_prefix_next() returns next matched node
+ *  (cursor->key and cursor->len hold its key) or NULL. TT_prefix_close()
+ *  frees spilled memory, if any. TT_prefix_count() just counts matches.
+ *  Cursor takes no lock: in T_CONCURRENT tree keep whole enumeration (from
+ *  TT_prefix_cursor() to TT_prefix_close()) inside TT_read_begin() /
+ *  TT_read_end(), other trees must be locked by caller while cursor is
+ *  used. TT_prefix_count() protects itself.
+ */
+int TT_prefix_cursor( const TTree tree, const char *prefix,
+                      TT_Cursor *cursor );
+TTNodeConst TT_prefix_next( TT_Cursor *cursor );
+void TT_prefix_close( TT_Cursor *cursor );
+size_t TT_prefix_count( const TTree tree, const char *prefix );
+/*
+ *  Same as TT_prefix_count(), but T_COUNTS tree answers in prefix length
+ *  time (other trees count matches with cursor). Both ways run in read
+ *  section of T_CONCURRENT tree or under the lock.
+ */
+size_t TT_count_prefix( const TTree tree, const char *prefix );
+/*
+ *  Get k keys started by prefix (NULL or empty prefix means all keys) with
+ *  highest weights, in descending weight order. Set *out to allocated
+ *  TT_Data array wich must be freed by free() or NULL, and return array
+ *  length. Trees without T_WEIGHTS flag return first k keys, like
+ *  TT_nlookup().
+ */
+size_t TT_topk( const TTree tree, const char *prefix, size_t k,
+                TT_DataConst *out );
 /*
  *  Lookup nodes with key started by prefix in new tree. Field 'destructor' in
  *  new tree is NULL.
  */
 TTree TT_lookup_tree( const TTree tree, const char *prefix );
 /*
- *  Delete tree node with specified key. Return 0 if node is not found, or 1.
+ *  Set operations. Both trees are walked together, so shared prefixes are
+ *  compared once and subtrees missing in other tree are copied or skipped
+ *  whole. Keys are compared as stored (folded in T_NOCASE tree), weights
+ *  are copied to T_WEIGHTS tree. Data pointers are shared, not copied.
+ *
+ *  TT_merge() inserts keys of 'src' into 'dst' (existing keys of 'dst' are
+ *  replaced only if 'dst' has T_INSERT_REPLACE flag). Return 0 if memory
+ *  allocation fails, or 1.
+ *
+ *  TT_intersect() and TT_diff() return new tree (with flags of 'a' and NULL
+ *  'destructor') with keys of 'a' which are (or are not) in 'b', or NULL.
+ */
+int TT_merge( const TTree dst, const TTree src );
+TTree TT_intersect( const TTree a, const TTree b );
+TTree TT_diff( const TTree a, const TTree b );
+/*
+ *  Create view of keys started by prefix (NULL or empty prefix means all
+ *  keys) without copying. Keys passed to view functions and returned by
+ *  them are relative to view prefix. Same semantics as TT_search(),
+ *  TT_lookup(), TT_nlookup() (NULL or empty prefix means all view keys) and
+ *  TT_walk_keys(). View stays valid while tree is modified, it must be
+ *  closed with TT_view_close() before tree is destroyed.
+ */
+TT_View TT_view( const TTree tree, const char *prefix );
+void TT_view_close( TT_View view );
+TTNodeConst TT_view_search( const TT_View view, const char *key );
+TT_DataConst TT_view_lookup( const TT_View view, const char *prefix,
+                             size_t *count );
+TT_DataConst TT_view_nlookup( const TT_View view, const char *prefix,
+                              size_t max, size_t *count );
+int TT_view_walk_keys( const TT_View view, TT_KeyWalk walker, void *data );
+/*
+ *  Delete key and all longer keys started by it. Return 0 if key is not
+ *  found, or 1.
  */
 int TT_del_node( const TTree tree, const char *key );
 /*
  *  Delete tree key. Return 0 if key is not found, or 1.
  */
 int TT_del_key( const TTree tree, const char *key );
+/*
+ *  Both functions above remove nodes left without keys. TT_compact()
+ *  rebuilds tree to minimal one with balanced splitter trees, branch by
+ *  branch. Keys of branch are copied under the lock, new branch is built
+ *  without it and replaces old one if tree was not changed meanwhile (or it
+ *  is built again, up to TT_COMPACT_TRIES times, then branch is left as
+ *  is). Arena memory (T_ARENA tree, or TT_build_parallel()) used before is
+ *  released if every branch is rebuilt. Return 0 if memory allocation fails
+ *  (tree stays valid), or 1.
+ */
+int TT_compact( const TTree tree );
 
 /*
- *  Get tree information.
+ *  Get tree information. Statistics are kept up to date by every change, so
+ *  all functions below are O(1) (TT_histogram() copies 'size' values at
+ *  most). Search path length is number of bytes compared to find key (run
+ *  bytes are compared one by one), depth is the longest one. TT_histogram()
+ *  gets number of nodes on each level (run nodes are counted at level of
+ *  their last byte) and returns depth (number of levels).
  */
 size_t TT_depth( const TTree tree );
+int TT_stats( const TTree tree, TT_Stats *stats );
+size_t TT_histogram( const TTree tree, size_t *levels, size_t size );
 
 /*
  *  Get data from tree. Return pointer to allocated TT_Data array (sorted by
@@ -105,6 +338,36 @@ TT_DataConst TT_data( const TTree tree, size_t *count );
 void TT_walk( const TTree tree, TT_Walk wakler, void *data );
 void TT_walk_asc( const TTree tree, TT_Walk walker, void *data );
 void TT_walk_desc( const TTree tree, TT_Walk wakler, void *data );
+/*
+ *  Walk keys in ascending order. Return 0 if walker stopped walking, or 1.
+ */
+int TT_walk_keys( const TTree tree, TT_KeyWalk walker, void *data );
+/*
+ *  Walk keys from 'lo' (inclusive) to 'hi' (exclusive), in ascending or
+ *  descending order. NULL bound means no bound. Branches outside of range
+ *  are skipped. Return 0 if walker stopped walking (or operation fails),
+ *  or 1.
+ */
+int TT_walk_range( const TTree tree, const char *lo, const char *hi,
+                   TT_KeyWalk walker, void *data );
+int TT_walk_range_desc( const TTree tree, const char *lo, const char *hi,
+                        TT_KeyWalk walker, void *data );
+/*
+ *  Walk keys (in ascending order) within Levenshtein distance 'max' from
+ *  query. Subtrees which can not match are skipped. Return 0 if walker
+ *  stopped walking (or operation fails), or 1.
+ */
+int TT_fuzzy( const TTree tree, const char *query, size_t max,
+              TT_KeyWalk walker, void *data );
+/*
+ *  Walk keys (in ascending order) matching pattern: '?' matches any byte
+ *  (zero byte of binary key too), '[...]' matches class of bytes
+ *  ('[a-z0-9_]', negated with '[!...]' or '[^...]', which also matches zero
+ *  byte), '\' escapes next byte, other bytes match themselves. Return
+ *  0 if walker stopped walking (or operation fails), or 1.
+ */
+int TT_match( const TTree tree, const char *pattern, TT_KeyWalk walker,
+              void *data );
 int TT_dump( TTree const tree, Tree_DataDump dumper, FILE *handle );
 
 #ifdef __cplusplus